@@ -0,0 +1,611 @@
+/*
+ * Bus Bench
+ * Replays captured bus traces through the code that runs on the ESP, on the
+ * host, so regressions in the polling and parsing paths show up as numbers
+ * before they reach a unit.
+ *
+ *   xye     xye_protocol.h against a mocked HardwareSerial: the receive and
+ *           query intervals of the XYE configurations poll a simulated unit
+ *           that answers with the responses of the trace. Command packets in
+ *           the trace become mode/fan/setpoint requests.
+ *   modbus  the requests of the trace are sent and answered with their
+ *           responses, the bytes go through heatpump_bus_stats.h, and every
+ *           valid read response through the register decoders of a model
+ *           (the modbus_controller lambdas, see extract_decoders.py).
+ *   lane    the write lane of heatpump_registers.h on fixed controller
+ *           queues: writes behind the front, adjacent and not, with reads in
+ *           between. Prints every case and fails when a queue comes out
+ *           different from the expected one. Takes no trace.
+ *
+ * All bytes are timed at the configured baud rate (10 bits per byte) on a
+ * simulated clock, so a replay takes as long as the bus needs in simulated
+ * time and as long as the code needs in host time.
+ *
+ * Build (see DEVELOPMENT.md):
+ *   bench/extract_decoders.py models/R290-generic.yaml > bench/build/decoders.h
+ *   g++ -std=gnu++17 -O2 -Ibench/mock -Ibench/build -Imodels bench/bus_bench.cpp -o bench/build/bus-bench
+ *
+ * Usage:
+ *   bus-bench lane
+ *   bus-bench xye|modbus <trace> [options]
+ *     --baud N          baud rate (xye 4800, modbus 9600)
+ *     --turnaround MS   time from the end of a request to the response (20)
+ *     --noise P         probability of a flipped bit per received byte (0)
+ *     --drop P          probability of a lost received byte (0)
+ *     --seed N          seed of the noise (1)
+ *     --loops N         replay the trace N times (1)
+ *     --poll MS         xye: fixed query interval instead of the scheduler
+ *     --send-wait MS    modbus: response timeout (250)
+ */
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Logging is compiled out on the bench
+#define ESP_LOGE(tag, ...) ((void) 0)
+#define ESP_LOGW(tag, ...) ((void) 0)
+#define ESP_LOGI(tag, ...) ((void) 0)
+#define ESP_LOGD(tag, ...) ((void) 0)
+#define ESP_LOGV(tag, ...) ((void) 0)
+
+#include "xye_protocol.h"
+#include "heatpump_registers.h"
+#include "heatpump_bus_stats.h"
+
+#include "bus_sim.h"
+
+using namespace esphome;
+using namespace esphome::modbus_controller;
+
+// ============================================================================
+// Register Decoding
+// ============================================================================
+//
+// What the modbus_controller sensors do with a read response before their
+// lambda runs: x is the value at the entity's offset, masked with its bitmask.
+
+struct BenchDecoder {
+    const char* name;
+    SensorItem item;
+    bool (*decode)(SensorItem* item, const std::vector<uint8_t>& data);
+};
+
+static uint32_t benchDecoded = 0;  // Decoders that returned a value
+
+template<typename T>
+static bool benchSink(const optional<T>& value) {
+    benchDecoded += value.has_value();
+    return value.has_value();
+}
+
+static uint32_t benchWord(const SensorItem* item, const std::vector<uint8_t>& data, uint8_t word) {
+    size_t at = item->offset + word * 2;
+    return at + 1 < data.size() ? (data[at] << 8) | data[at + 1] : 0;
+}
+
+static uint32_t benchMask(uint32_t value, uint32_t bitmask) {
+    if (bitmask == 0xFFFFFFFF || bitmask == 0) {
+        return value;
+    }
+    return (value & bitmask) >> __builtin_ctz(bitmask);
+}
+
+static float benchNumber(const SensorItem* item, const std::vector<uint8_t>& data) {
+    uint32_t high = benchWord(item, data, 0);
+    uint32_t low = benchWord(item, data, 1);
+    uint32_t value;
+    switch (item->sensor_value_type) {
+        case SensorValueType::U_WORD:
+            return benchMask(high, item->bitmask);
+        case SensorValueType::S_WORD:
+            return static_cast<int16_t>(benchMask(high, item->bitmask));
+        case SensorValueType::U_DWORD:
+            return benchMask(high << 16 | low, item->bitmask);
+        case SensorValueType::U_DWORD_R:
+            return benchMask(low << 16 | high, item->bitmask);
+        case SensorValueType::S_DWORD:
+            return static_cast<int32_t>(benchMask(high << 16 | low, item->bitmask));
+        case SensorValueType::S_DWORD_R:
+            return static_cast<int32_t>(benchMask(low << 16 | high, item->bitmask));
+        case SensorValueType::FP32:
+        case SensorValueType::FP32_R: {
+            value = item->sensor_value_type == SensorValueType::FP32 ? high << 16 | low : low << 16 | high;
+            float number;
+            memcpy(&number, &value, sizeof(number));
+            return number;
+        }
+        default:
+            return NAN;
+    }
+}
+
+static bool benchBit(const SensorItem* item, const std::vector<uint8_t>& data) {
+    return (benchWord(item, data, 0) & item->bitmask) != 0;
+}
+
+static std::string benchText(const SensorItem* item, const std::vector<uint8_t>& data) {
+    std::string text;
+    char buffer[8];
+    for (size_t i = item->offset; i < data.size() && i < item->offset + item->response_bytes; i++) {
+        switch (item->encode) {
+            case RawEncoding::HEXBYTES:
+                snprintf(buffer, sizeof(buffer), "%02x", data[i]);
+                text += buffer;
+                break;
+            case RawEncoding::COMMA:
+                snprintf(buffer, sizeof(buffer), text.empty() ? "%d" : ",%d", data[i]);
+                text += buffer;
+                break;
+            default:
+                text += static_cast<char>(data[i]);
+                break;
+        }
+    }
+    return text;
+}
+
+#include "decoders.h"
+
+// ============================================================================
+// Options
+// ============================================================================
+
+struct BenchOptions {
+    bool lane = false;
+    bool xye = true;
+    const char* trace = nullptr;
+    uint32_t baud = 0;
+    uint32_t turnaroundMs = 20;
+    double noise = 0;
+    double drop = 0;
+    uint32_t seed = 1;
+    uint32_t loops = 1;
+    int32_t pollMs = -1;
+    uint32_t sendWaitMs = 250;
+};
+
+static bool parseOptions(int argc, char** argv, BenchOptions& options) {
+    if (argc == 2 && strcmp(argv[1], "lane") == 0) {
+        options.lane = true;
+        return true;
+    }
+    if (argc < 3 || (strcmp(argv[1], "xye") != 0 && strcmp(argv[1], "modbus") != 0)) {
+        return false;
+    }
+    options.xye = strcmp(argv[1], "xye") == 0;
+    options.trace = argv[2];
+    options.baud = options.xye ? 4800 : 9600;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const char* name = argv[i];
+        const char* value = argv[i + 1];
+        if (strcmp(name, "--baud") == 0) {
+            options.baud = strtoul(value, nullptr, 10);
+        } else if (strcmp(name, "--turnaround") == 0) {
+            options.turnaroundMs = strtoul(value, nullptr, 10);
+        } else if (strcmp(name, "--noise") == 0) {
+            options.noise = strtod(value, nullptr);
+        } else if (strcmp(name, "--drop") == 0) {
+            options.drop = strtod(value, nullptr);
+        } else if (strcmp(name, "--seed") == 0) {
+            options.seed = strtoul(value, nullptr, 10);
+        } else if (strcmp(name, "--loops") == 0) {
+            options.loops = strtoul(value, nullptr, 10);
+        } else if (strcmp(name, "--poll") == 0) {
+            options.pollMs = strtol(value, nullptr, 10);
+        } else if (strcmp(name, "--send-wait") == 0) {
+            options.sendWaitMs = strtoul(value, nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return (argc - 3) % 2 == 0 && options.baud > 0 && options.loops > 0;
+}
+
+// ============================================================================
+// XYE Replay
+// ============================================================================
+
+// Stop a replay that no longer makes progress (simulated time)
+#define BENCH_MAX_SIM_US (24ULL * 3600 * 1000000)
+
+static int benchXye(const BenchOptions& options, const std::vector<TracePacket>& trace) {
+    // Responses and command packets in trace order. SNIFF dumps leave out
+    // the CRC and prologue of a response, they are added back.
+    std::vector<TracePacket> events;
+    uint32_t responses = 0;
+    for (const TracePacket& packet : trace) {
+        std::vector<uint8_t> bytes = packet.bytes;
+        if (!packet.tx && bytes.size() == REC_CRC && bytes[0] == XYE_PREAMBLE) {
+            bytes.push_back(0);
+            bytes.push_back(XYE_PROLOGUE);
+            bytes[REC_CRC] = xyeCrc(bytes.data(), REC_LEN, REC_CRC);
+        }
+        if (!packet.tx && bytes.size() == REC_LEN) {
+            events.push_back(TracePacket{false, bytes});
+            responses++;
+        } else if (packet.tx && bytes.size() == SEND_LEN && bytes[1] != XYE_CMD_QUERY) {
+            events.push_back(TracePacket{true, bytes});
+        }
+    }
+    if (responses == 0) {
+        fprintf(stderr, "%s: no XYE responses\n", options.trace);
+        return 1;
+    }
+
+    NoisyLine line(options.noise, options.drop, options.seed);
+    CpuTimer cpu;
+    LatencyStats acks;
+    uint32_t answered = 0;
+    uint32_t corrupted = 0;
+    uint32_t lostCommands = 0;
+    uint32_t timeouts = 0;
+    uint32_t validated = 0;
+
+    size_t next = 0;
+    uint32_t loop = 0;
+    bool done = false;
+    uint32_t requestedAt = 0;
+    bool requested = false;
+    uint32_t inflightRequestedAt = 0;
+
+    xyeSerial.begin(options.baud, SERIAL_8N1, RX_PIN, TX_PIN);
+    if (options.pollMs >= 0) {
+        xyeState.scheduler.configure(options.pollMs, options.pollMs, 0);
+    }
+
+    // The unit answers every packet with the next response of the trace
+    xyeSerial.onWrite = [&](const uint8_t* data, size_t len) {
+        if (data[1] != XYE_CMD_QUERY) {
+            inflightRequestedAt = requestedAt;
+            requested = !xyeState.commands.empty();
+        }
+        if (next >= events.size() || events[next].tx) {
+            return;
+        }
+        uint64_t byteUs = xyeSerial.byteUs();
+        uint64_t at = simClock.us + len * byteUs + options.turnaroundMs * 1000ULL;
+        uint32_t hits = line.hits();
+        for (uint8_t byte : events[next].bytes) {
+            at += byteUs;
+            if (line.pass(byte)) {
+                xyeSerial.receive(byte, at);
+            }
+        }
+        corrupted += line.hits() != hits;
+        answered++;
+        next++;
+    };
+
+    while (!done && simClock.us < BENCH_MAX_SIM_US) {
+        // Commands of the trace are requested once the replay reaches them
+        while (next < events.size() && events[next].tx) {
+            const uint8_t* packet = events[next].bytes.data();
+            if (!requested) {
+                requestedAt = millis();
+                requested = true;
+            }
+            if (packet[1] == XYE_CMD_SET) {
+                xyeState.requestMode(packet[xyeState.sendModeIndex()]);
+                xyeState.requestFan(packet[SEND_FAN]);
+                xyeState.requestTemp(packet[SEND_TEMP]);
+            } else {
+                xyeState.commands.push(packet[1]);
+            }
+            next++;
+        }
+        if (next >= events.size() && ++loop < options.loops) {
+            next = 0;
+            continue;
+        }
+
+        uint32_t now = millis();
+
+        // Receive path, interval 10ms
+        if (now % 10 == 0) {
+            bool acking = xyeState.commandSent;
+            XYERxStatus rx = cpu.measure([&] {
+                XYERxStatus status = xyeState.receive(now);
+                xyeState.handleResult(status, now);
+                return status;
+            });
+            if (rx == XYE_RX_FRAME) {
+                validated++;
+                if (acking) {
+                    acks.add(now - inflightRequestedAt);
+                }
+            } else if (rx == XYE_RX_TIMEOUT) {
+                timeouts++;
+                lostCommands += acking;
+            }
+            if (xyeState.canSendCommand()) {
+                const uint8_t* packet = xyeState.takeCommand();
+                xyeState.transmit(packet, SEND_LEN);
+                xyeState.scheduler.boost(now);
+                xyeState.commandSent = true;
+            }
+        }
+
+        // Query scheduler, interval 50ms
+        if (now % 50 == 0 && xyeState.scheduler.due(now) && xyeState.commands.empty() &&
+            !xyeState.waitingForResponse && xyeState.busIdle()) {
+            xyeState.transmit(xyeState.queryPacket.bytes, SEND_LEN);
+            xyeState.scheduler.onQuerySent(now);
+        }
+
+        done = next >= events.size() && !xyeState.waitingForResponse && xyeState.commands.empty();
+        simClock.us += 1000;
+    }
+
+    printf("XYE replay of %s: %u baud, turnaround %u ms, %u response(s) x %u\n", options.trace,
+           (unsigned) options.baud, (unsigned) options.turnaroundMs, (unsigned) responses, (unsigned) options.loops);
+    printf("  frames:   %u answered, %u validated, %u hit by noise (%u bits flipped, %u bytes lost)\n",
+           (unsigned) answered, (unsigned) validated, (unsigned) corrupted, (unsigned) line.flipped,
+           (unsigned) line.dropped);
+    printf("  commands: %u acknowledged, %u lost, command-to-ack worst %u ms, mean %.0f ms\n",
+           (unsigned) acks.count, (unsigned) lostCommands, (unsigned) acks.worst, acks.mean());
+    printf("  parser:   crc %u, framing %u, dropped partials %u, timeouts %u\n",
+           (unsigned) xyeState.parser.crcErrors, (unsigned) xyeState.parser.framingErrors,
+           (unsigned) xyeState.parser.droppedPartials, (unsigned) timeouts);
+    printRates(validated, simClock.us, cpu, "receive and handleResult");
+    return 0;
+}
+
+// ============================================================================
+// Modbus Replay
+// ============================================================================
+
+// Gap between a response and the next request (command_throttle 0ms)
+#define BENCH_MODBUS_GAP_US 1000
+
+static uint32_t benchDecode(const std::vector<uint8_t>& request, const std::vector<uint8_t>& response) {
+    ModbusRegisterType type = request[1] == 0x04 ? ModbusRegisterType::READ : ModbusRegisterType::HOLDING;
+    uint16_t start = (request[2] << 8) | request[3];
+    uint16_t count = (request[4] << 8) | request[5];
+    std::vector<uint8_t> data(response.begin() + 3, response.end() - 2);
+    uint32_t decoded = 0;
+    for (BenchDecoder& decoder : BENCH_DECODERS) {
+        SensorItem& item = decoder.item;
+        if (item.register_type != type || item.start_address < start ||
+            item.start_address + item.register_count > start + count) {
+            continue;
+        }
+        item.offset = (item.start_address - start) * 2;
+        decoded += decoder.decode(&item, data);
+    }
+    return decoded;
+}
+
+static int benchModbus(const BenchOptions& options, const std::vector<TracePacket>& trace) {
+    // Requests with the bytes received up to the next request
+    std::vector<TracePacket> requests;
+    std::vector<std::vector<uint8_t>> responses;
+    for (const TracePacket& packet : trace) {
+        if (packet.tx) {
+            requests.push_back(packet);
+            responses.emplace_back();
+        } else if (!requests.empty()) {
+            responses.back().insert(responses.back().end(), packet.bytes.begin(), packet.bytes.end());
+        }
+    }
+    if (requests.empty()) {
+        fprintf(stderr, "%s: no Modbus requests\n", options.trace);
+        return 1;
+    }
+
+    NoisyLine line(options.noise, options.drop, options.seed);
+    CpuTimer cpu;
+    LatencyStats acks;
+    uint32_t answered = 0;
+    uint32_t corrupted = 0;
+    uint32_t valid = 0;
+    uint32_t reads = 0;
+    uint32_t values = 0;
+    uint64_t byteUs = 10000000ULL / options.baud;
+    simClock.us = 1000000;
+
+    for (uint32_t loop = 0; loop < options.loops; loop++) {
+        for (size_t i = 0; i < requests.size(); i++) {
+            const std::vector<uint8_t>& request = requests[i].bytes;
+            uint64_t sentAt = simClock.us;
+            simClock.us += request.size() * byteUs;
+            cpu.measure([&] { bus_stats.onBytes(true, request, millis()); });
+            uint64_t txEnd = simClock.us;
+
+            std::vector<uint8_t> response;
+            uint32_t hits = line.hits();
+            for (uint8_t byte : responses[i]) {
+                if (line.pass(byte)) {
+                    response.push_back(byte);
+                }
+            }
+            if (responses[i].empty()) {
+                simClock.us = txEnd + options.sendWaitMs * 1000ULL;
+                continue;
+            }
+            answered++;
+            corrupted += line.hits() != hits;
+            uint64_t lastByte = txEnd + options.turnaroundMs * 1000ULL + responses[i].size() * byteUs;
+
+            // The uart debugger hands the bytes over when the next request starts
+            simClock.us = lastByte + BENCH_MODBUS_GAP_US;
+            bool frameValid = modbusFrameValid(response);
+            cpu.measure([&] {
+                bus_stats.onBytes(false, response, millis());
+                if (frameValid && (request[1] == 0x03 || request[1] == 0x04) && !(response[1] & 0x80)) {
+                    values += benchDecode(request, response);
+                    reads++;
+                }
+            });
+            if (!frameValid) {
+                // Dropped by the modbus component, the controller waits for the timeout
+                simClock.us = std::max<uint64_t>(simClock.us, txEnd + options.sendWaitMs * 1000ULL);
+                continue;
+            }
+            valid++;
+            if (request[1] == 0x06 || request[1] == 0x10) {
+                acks.add((lastByte - sentAt) / 1000);
+            }
+        }
+    }
+
+    printf("Modbus replay of %s: %u baud, turnaround %u ms, send wait %u ms, %u request(s) x %u\n",
+           options.trace, (unsigned) options.baud, (unsigned) options.turnaroundMs, (unsigned) options.sendWaitMs,
+           (unsigned) requests.size(), (unsigned) options.loops);
+    printf("  frames:   %u answered, %u valid, %u hit by noise (%u bits flipped, %u bytes lost)\n",
+           (unsigned) answered, (unsigned) valid, (unsigned) corrupted, (unsigned) line.flipped,
+           (unsigned) line.dropped);
+    printf("  writes:   %u acknowledged, command-to-ack worst %u ms, mean %.0f ms\n", (unsigned) acks.count,
+           (unsigned) acks.worst, acks.mean());
+    printf("  stats:    crc %u, exceptions %u, timeouts %u, latency p50 %u ms, max %u ms\n",
+           (unsigned) bus_stats.crcErrors, (unsigned) bus_stats.exceptions, (unsigned) bus_stats.timeouts,
+           (unsigned) bus_stats.latency.p50(), (unsigned) bus_stats.latency.max);
+    printf("  decode:   %u reads, %u values (%u decoders)\n", (unsigned) reads, (unsigned) values,
+           (unsigned) (sizeof(BENCH_DECODERS) / sizeof(BENCH_DECODERS[0])));
+    printRates(valid, simClock.us - 1000000, cpu, "bus stats and decoders");
+    return 0;
+}
+
+// ============================================================================
+// Write Lane
+// ============================================================================
+
+// Command on the bench queue: 'R' read or 'W' write, address and for a write
+// its values
+struct LaneCommand {
+    char kind;
+    uint16_t address;
+    std::vector<uint16_t> values;
+};
+
+struct LaneCase {
+    const char* name;
+    std::vector<LaneCommand> queue;
+    std::vector<LaneCommand> expected;
+};
+
+struct LaneBenchController : ModbusController {
+    std::list<std::unique_ptr<ModbusCommandItem>>& queue() {
+        return command_queue_;
+    }
+};
+
+static std::string laneText(const std::list<std::unique_ptr<ModbusCommandItem>>& queue) {
+    std::string text;
+    for (const auto& command : queue) {
+        bool write = command->function_code != ModbusFunctionCode::READ_HOLDING_REGISTERS;
+        text += text.empty() ? "" : " ";
+        text += (write ? "W" : "R") + std::to_string(command->register_address);
+        for (size_t i = 0; write && i + 1 < command->payload.size(); i += 2) {
+            text += (i == 0 ? "=" : ",") + std::to_string((command->payload[i] << 8) | command->payload[i + 1]);
+        }
+    }
+    return text;
+}
+
+static void laneQueue(LaneBenchController& controller, const std::vector<LaneCommand>& commands,
+                      uint32_t& answered) {
+    for (const LaneCommand& entry : commands) {
+        ModbusCommandItem command;
+        if (entry.kind == 'W') {
+            command = ModbusCommandItem::create_write_multiple_command(
+                &controller, entry.address, entry.values.size(), entry.values,
+                entry.values.size() == 1 ? ModbusFunctionCode::WRITE_SINGLE_REGISTER
+                                         : ModbusFunctionCode::WRITE_MULTIPLE_REGISTERS);
+            command.on_data_func = [&answered](ModbusRegisterType, uint16_t, const std::vector<uint8_t>&) {
+                answered++;
+            };
+        } else {
+            command.modbusdevice = &controller;
+            command.register_address = entry.address;
+            command.register_count = 1;
+        }
+        controller.queue().push_back(std::unique_ptr<ModbusCommandItem>(new ModbusCommandItem(command)));
+    }
+}
+
+static int benchLane() {
+    const std::vector<LaneCase> cases = {
+        {"write behind the front, apart",
+         {{'R', 0, {}}, {'W', 10, {1}}, {'R', 100, {}}, {'W', 20, {2}}},
+         {{'R', 0, {}}, {'W', 10, {1}}, {'W', 20, {2}}, {'R', 100, {}}}},
+        {"write behind the front, adjacent",
+         {{'R', 0, {}}, {'W', 10, {1}}, {'R', 100, {}}, {'W', 11, {2}}},
+         {{'R', 0, {}}, {'W', 10, {1, 2}}, {'R', 100, {}}}},
+        {"writes behind reads, adjacent and apart",
+         {{'R', 0, {}}, {'R', 100, {}}, {'W', 11, {2}}, {'R', 200, {}}, {'W', 10, {1}}, {'W', 20, {3}}},
+         {{'R', 0, {}}, {'W', 10, {1, 2}}, {'W', 20, {3}}, {'R', 100, {}}, {'R', 200, {}}}},
+        {"newer write to the same register",
+         {{'R', 0, {}}, {'W', 10, {1}}, {'R', 100, {}}, {'W', 10, {5}}},
+         {{'R', 0, {}}, {'W', 10, {5}}, {'R', 100, {}}}},
+        {"only writes behind the front",
+         {{'W', 5, {9}}, {'W', 10, {1}}, {'W', 11, {2}}},
+         {{'W', 5, {9}}, {'W', 10, {1, 2}}}},
+        {"nothing to reorder",
+         {{'R', 0, {}}, {'W', 10, {1}}, {'W', 20, {2}}, {'R', 100, {}}},
+         {{'R', 0, {}}, {'W', 10, {1}}, {'W', 20, {2}}, {'R', 100, {}}}},
+    };
+
+    int failed = 0;
+    printf("Write lane, %u case(s)\n", (unsigned) cases.size());
+    for (const LaneCase& test : cases) {
+        LaneBenchController controller;
+        ModbusWriteLane lane;
+        uint32_t answered = 0;
+        uint32_t writes = 0;
+        laneQueue(controller, test.queue, answered);
+        for (const LaneCommand& entry : test.queue) {
+            writes += entry.kind == 'W' && &entry != &test.queue.front();
+        }
+        lane.service(&controller);
+
+        LaneBenchController reference;
+        uint32_t unused = 0;
+        laneQueue(reference, test.expected, unused);
+        std::string result = laneText(controller.queue());
+        std::string expected = laneText(reference.queue());
+
+        // Every taken write still gets the response of the write it went into
+        bool first = true;
+        for (const auto& command : controller.queue()) {
+            if (!first && command->on_data_func) {
+                command->on_data_func(command->register_type, command->register_address, {});
+            }
+            first = false;
+        }
+        bool ok = result == expected && answered == writes;
+        failed += !ok;
+        printf("  %-4s %-40s %s\n", ok ? "ok" : "FAIL", test.name, result.c_str());
+        if (!ok) {
+            printf("       expected %s, %u of %u write handler(s) called\n", expected.c_str(), (unsigned) answered,
+                   (unsigned) writes);
+        }
+    }
+    return failed != 0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s xye|modbus <trace> [--baud N] [--turnaround MS] [--noise P] [--drop P]\n"
+                        "       [--seed N] [--loops N] [--poll MS] [--send-wait MS]\n"
+                        "       %s lane\n", argv[0], argv[0]);
+        return 2;
+    }
+    if (options.lane) {
+        return benchLane();
+    }
+    std::vector<TracePacket> trace;
+    if (!readTrace(options.trace, trace)) {
+        fprintf(stderr, "%s: cannot open\n", options.trace);
+        return 1;
+    }
+    return options.xye ? benchXye(options, trace) : benchModbus(options, trace);
+}
@@ -0,0 +1,202 @@
+/*
+ * Bus Bench Helpers
+ * Trace parsing, noise injection and the numbers the bench reports.
+ *
+ * Two trace formats are read, mixed freely:
+ *   SNIFF dumps   the ESPHome log of the XYE configurations with "Sniff XYE
+ *                 Traffic" on: a "TX PACKET" or "RX PACKET" line, then the
+ *                 "RAW:" line(s) with the bytes
+ *   byte dumps    ">>> 01:03:00:64:00:0A:85:D2" for sent and "<<< ..." for
+ *                 received bytes, as logged by uart.debug.log_hex; bytes may
+ *                 be separated by ':', ',' or spaces
+ * Anything before the last "]: " of a line (the ESPHome log prefix) is
+ * ignored, so captured logs can be used as they are.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Traces
+// ============================================================================
+
+struct TracePacket {
+    bool tx;
+    std::vector<uint8_t> bytes;
+};
+
+// Hex bytes of `text`, false if anything else is in it
+inline bool parseHexBytes(const char* text, std::vector<uint8_t>& bytes) {
+    bytes.clear();
+    while (*text != '\0') {
+        if (*text == ' ' || *text == ':' || *text == ',' || *text == '\t' || *text == '\r' || *text == '\n') {
+            text++;
+            continue;
+        }
+        char* end = nullptr;
+        unsigned long value = strtoul(text, &end, 16);
+        if (end == text || end - text > 2) {
+            return false;
+        }
+        bytes.push_back(static_cast<uint8_t>(value));
+        text = end;
+    }
+    return !bytes.empty();
+}
+
+inline bool readTrace(const char* path, std::vector<TracePacket>& packets) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+    char line[512];
+    bool snifferTx = false;
+    bool open = false;  // The last packet can still get bytes (RAW continuation line)
+    std::vector<uint8_t> bytes;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        const char* text = line;
+        for (const char* at = strstr(line, "]: "); at != nullptr; at = strstr(at + 1, "]: ")) {
+            text = at + 3;
+        }
+        while (*text == ' ') {
+            text++;
+        }
+
+        if (strstr(text, "TX PACKET") != nullptr || strstr(text, "RX PACKET") != nullptr) {
+            snifferTx = strstr(text, "TX PACKET") != nullptr;
+            open = false;
+        } else if (strncmp(text, "RAW:", 4) == 0 && parseHexBytes(text + 4, bytes)) {
+            packets.push_back(TracePacket{snifferTx, bytes});
+            open = true;
+        } else if ((strncmp(text, ">>>", 3) == 0 || strncmp(text, "<<<", 3) == 0) && parseHexBytes(text + 3, bytes)) {
+            packets.push_back(TracePacket{text[0] == '>', bytes});
+            open = false;
+        } else if (open && parseHexBytes(text, bytes)) {
+            packets.back().bytes.insert(packets.back().bytes.end(), bytes.begin(), bytes.end());
+        } else {
+            open = false;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// ============================================================================
+// Noise
+// ============================================================================
+
+// Corrupts received bytes: a flipped bit with probability flipRate, a lost
+// byte (framing error on the UART) with probability dropRate
+class NoisyLine {
+public:
+    uint32_t flipped = 0;
+    uint32_t dropped = 0;
+
+    NoisyLine(double flipRate, double dropRate, uint32_t seed) : flipRate(flipRate), dropRate(dropRate), random(seed) {}
+
+    // False when the byte is lost
+    bool pass(uint8_t& byte) {
+        if (dropRate > 0 && chance(random) < dropRate) {
+            dropped++;
+            return false;
+        }
+        if (flipRate > 0 && chance(random) < flipRate) {
+            byte ^= 1 << (random() % 8);
+            flipped++;
+        }
+        return true;
+    }
+
+    // Corrupted bytes so far, to tell whether a frame was hit
+    uint32_t hits() const {
+        return flipped + dropped;
+    }
+
+private:
+    double flipRate;
+    double dropRate;
+    std::mt19937 random;
+    std::uniform_real_distribution<double> chance{0.0, 1.0};
+};
+
+// ============================================================================
+// Measurements
+// ============================================================================
+
+// Host time spent in the measured code
+class CpuTimer {
+public:
+    template<typename F>
+    auto measure(F&& code) {
+        auto start = std::chrono::steady_clock::now();
+        struct Stop {
+            CpuTimer* timer;
+            std::chrono::steady_clock::time_point start;
+            ~Stop() {
+                timer->total += std::chrono::steady_clock::now() - start;
+            }
+        } stop{this, start};
+        return code();
+    }
+
+    double ns() const {
+        return std::chrono::duration<double, std::nano>(total).count();
+    }
+
+private:
+    std::chrono::steady_clock::duration total{0};
+};
+
+struct LatencyStats {
+    uint32_t count = 0;
+    uint32_t worst = 0;
+    uint64_t sum = 0;
+
+    void add(uint32_t ms) {
+        count++;
+        sum += ms;
+        worst = ms > worst ? ms : worst;
+    }
+
+    double mean() const {
+        return count == 0 ? 0.0 : static_cast<double>(sum) / count;
+    }
+};
+
+// Frames per second of simulated time and per second of host time
+inline void printRates(uint32_t frames, uint64_t simulatedUs, const CpuTimer& cpu, const char* measured) {
+    double seconds = simulatedUs / 1e6;
+    printf("  bus:      %.1f s simulated, %.2f frames/s\n", seconds, seconds > 0 ? frames / seconds : 0.0);
+    if (frames > 0) {
+        double perFrame = cpu.ns() / frames;
+        printf("  cpu:      %.0f ns per frame (%s), %.0f frames/s\n", perFrame, measured,
+               perFrame > 0 ? 1e9 / perFrame : 0.0);
+    }
+}
+
+// Modbus RTU CRC (low byte first on the wire)
+inline uint16_t modbusCrc(const uint8_t* data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+inline bool modbusFrameValid(const std::vector<uint8_t>& frame) {
+    if (frame.size() < 5) {
+        return false;
+    }
+    uint16_t crc = frame[frame.size() - 2] | (frame[frame.size() - 1] << 8);
+    return crc == modbusCrc(frame.data(), frame.size() - 2);
+}
@@ -0,0 +1,127 @@
+#!/usr/bin/env -S uv run
+# /// script
+# requires-python = ">=3.8"
+# dependencies = [
+#     "ruamel.yaml",
+# ]
+# ///
+#
+# Writes the register decoders of a generated model file (models/*.yaml) as
+# C++ for the bus bench: every modbus_controller sensor, binary sensor and
+# text sensor with its address and value type, and its decode lambda.
+#
+#   bench/extract_decoders.py models/R290-generic.yaml > bench/build/decoders.h
+import re
+import sys
+from ruamel.yaml import YAML
+
+REGISTER_TYPES = {
+    "holding": "HOLDING",
+    "read": "READ",
+}
+
+VALUE_TYPES = ("U_WORD", "S_WORD", "U_DWORD", "U_DWORD_R", "S_DWORD", "S_DWORD_R", "FP32", "FP32_R")
+
+# Entity kind: lambda signature and the bench helper that computes x
+KINDS = {
+    "sensor": ("float x", "optional<float>", "benchNumber(item, data)"),
+    "binary_sensor": ("bool x", "optional<bool>", "benchBit(item, data)"),
+    "text_sensor": ("std::string& x", "optional<std::string>", "benchText(item, data)"),
+}
+
+
+def substitute(text, substitutions):
+    return re.sub(r"\$\{(\w+)\}", lambda m: str(substitutions.get(m.group(1), m.group(0))), text)
+
+
+def indent(text, spaces):
+    return "".join((" " * spaces + line) if line.strip() else line for line in text.splitlines(True))
+
+
+def decoder(index, component, entity, substitutions):
+    signature, result, value = KINDS[component]
+    name = substitute(str(entity.get("name", entity.get("id", ""))), substitutions)
+    lines = [f"// {name}"]
+    lines.append(f"static bool decode_{index}(SensorItem* item, const std::vector<uint8_t>& data) {{")
+    body = entity.get("lambda")
+    if body is not None and "id(" in str(body):
+        # Other entities are not available on the bench
+        lines[0] += " (lambda uses id(), decoded by value type only)"
+        body = None
+    if body is None:
+        if component == "text_sensor":
+            lines.append(f"    std::string x = {value};")
+            lines.append(f"    return benchSink({result}(x));")
+        else:
+            lines.append(f"    return benchSink({result}({value}));")
+    else:
+        if component == "text_sensor":
+            lines.append(f"    std::string x = {value};")
+            argument = "x"
+        else:
+            argument = value
+        lines.append(f"    auto decode = [](SensorItem* item, {signature}, const std::vector<uint8_t>& data) -> {result} {{")
+        lines.append(indent(substitute(str(body), substitutions), 8).rstrip("\n"))
+        lines.append("    };")
+        lines.append(f"    return benchSink(decode(item, {argument}, data));")
+    lines.append("}")
+    return "\n".join(lines)
+
+
+def item(component, entity):
+    register_type = REGISTER_TYPES.get(str(entity.get("register_type", "")).lower())
+    value_type = str(entity.get("value_type", "U_WORD")).upper()
+    if register_type is None or (component != "text_sensor" and value_type not in VALUE_TYPES):
+        return None
+    count = int(entity.get("register_count", 2 if "DWORD" in value_type or "FP32" in value_type else 1))
+    default_mask = 0x1 if component == "binary_sensor" else 0xFFFFFFFF
+    bitmask = int(entity.get("bitmask", default_mask))
+    response = int(entity.get("response_size", count * 2))
+    encode = str(entity.get("raw_encode", "NONE")).upper()
+    return (f"ModbusRegisterType::{register_type}, {int(entity['address'])}, {count}, "
+            f"SensorValueType::{value_type if value_type in VALUE_TYPES else 'RAW'}, 0x{bitmask:X}, "
+            f"{response}, RawEncoding::{encode}, 0")
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(f"usage: {sys.argv[0]} models/<model>.yaml")
+    model_file = sys.argv[1]
+    yaml = YAML()
+    with open(model_file, "r") as f:
+        data = yaml.load(f)
+    substitutions = data.get("substitutions", {}) or {}
+
+    decoders = []
+    table = []
+    for component in KINDS:
+        for entity in data.get(component, []) or []:
+            if entity.get("platform") != "modbus_controller" or "address" not in entity:
+                continue
+            fields = item(component, entity)
+            if fields is None:
+                continue
+            index = len(decoders)
+            decoders.append(decoder(index, component, entity, substitutions))
+            name = substitute(str(entity.get("name", entity.get("id", ""))), substitutions).replace('"', '\\"')
+            table.append(f'    {{"{name}", {{{fields}}}, decode_{index}}},')
+
+    print(f"// Generated by bench/extract_decoders.py from {model_file}, do not edit")
+    print()
+    print("#pragma once")
+    print()
+    # Enum tables the decode lambdas look their texts up in
+    includes = [str(name) for name in (data.get("esphome", {}) or {}).get("includes", []) or []]
+    for name in includes:
+        if name.endswith("-enums.h"):
+            print(f'#include "{name}"')
+            print()
+    print("\n\n".join(decoders))
+    print()
+    print("static BenchDecoder BENCH_DECODERS[] = {")
+    print("\n".join(table))
+    print("};")
+
+
+if __name__ == "__main__":
+    main()
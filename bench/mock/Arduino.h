@@ -0,0 +1,23 @@
+/*
+ * Bench replacement for the Arduino core, only what the headers in models/
+ * use. The time is the simulated bus time (sim_clock.h).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "sim_clock.h"
+
+#define SERIAL_8N1 0x800001c
+
+inline uint32_t millis() {
+    return simClock.ms();
+}
+
+inline uint32_t micros() {
+    return static_cast<uint32_t>(simClock.us);
+}
@@ -0,0 +1,73 @@
+/*
+ * Bench replacement for the Arduino HardwareSerial. Received bytes are
+ * queued by the bench with the simulated time their stop bit ends, and
+ * only show up in available()/read() once the clock has passed it. Written
+ * bytes are handed to onWrite.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+#include "sim_clock.h"
+
+class HardwareSerial {
+public:
+    // Called for every write() with the bytes written
+    std::function<void(const uint8_t* data, size_t len)> onWrite;
+
+    explicit HardwareSerial(int uart) {}
+
+    void begin(unsigned long baud, uint32_t config = 0, int rxPin = -1, int txPin = -1) {
+        baudRate = baud;
+    }
+
+    int available() {
+        int count = 0;
+        for (const Byte& byte : rx) {
+            if (byte.at > simClock.us) {
+                break;
+            }
+            count++;
+        }
+        return count;
+    }
+
+    int read() {
+        if (rx.empty() || rx.front().at > simClock.us) {
+            return -1;
+        }
+        uint8_t value = rx.front().value;
+        rx.pop_front();
+        return value;
+    }
+
+    size_t write(const uint8_t* data, size_t len) {
+        if (onWrite) {
+            onWrite(data, len);
+        }
+        return len;
+    }
+
+    // Bench side: a byte that has been received completely at `at` (us)
+    void receive(uint8_t value, uint64_t at) {
+        rx.push_back(Byte{at, value});
+    }
+
+    // Time on the line per byte (start, 8 data and stop bit)
+    uint64_t byteUs() const {
+        return 10000000ULL / baudRate;
+    }
+
+private:
+    struct Byte {
+        uint64_t at;
+        uint8_t value;
+    };
+
+    unsigned long baudRate = 4800;
+    std::deque<Byte> rx;
+};
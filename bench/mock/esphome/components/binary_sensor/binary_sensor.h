@@ -0,0 +1,21 @@
+/*
+ * Bench replacement for the ESPHome binary_sensor component, only what
+ * heatpump_registers.h uses.
+ */
+
+#pragma once
+
+namespace esphome {
+namespace binary_sensor {
+
+class BinarySensor {
+public:
+    bool state = false;
+
+    void publish_state(bool value) {
+        state = value;
+    }
+};
+
+}  // namespace binary_sensor
+}  // namespace esphome
@@ -0,0 +1,23 @@
+/*
+ * Bench replacement for the ESPHome modbus component, only what
+ * heatpump_bus_stats.h uses.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace modbus {
+
+class Modbus {
+public:
+    uint16_t sendWaitTime = 250;
+
+    void set_send_wait_time(uint16_t time) {
+        sendWaitTime = time;
+    }
+};
+
+}  // namespace modbus
+}  // namespace esphome
@@ -0,0 +1,156 @@
+/*
+ * Bench replacement for the ESPHome modbus_controller component: the
+ * command queue and read ranges used by heatpump_registers.h, and the
+ * sensor item and helpers the register decode lambdas use.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace esphome {
+
+template<typename T>
+using optional = std::optional<T>;
+
+using std::to_string;
+
+namespace modbus_controller {
+
+enum class ModbusRegisterType : uint8_t {
+    CUSTOM = 0x0,
+    COIL = 0x01,
+    DISCRETE_INPUT = 0x02,
+    HOLDING = 0x03,
+    READ = 0x04,
+};
+
+enum class ModbusFunctionCode {
+    READ_HOLDING_REGISTERS = 0x03,
+    READ_INPUT_REGISTERS = 0x04,
+    WRITE_SINGLE_REGISTER = 0x06,
+    WRITE_MULTIPLE_REGISTERS = 0x10,
+};
+
+enum class SensorValueType : uint8_t {
+    RAW,
+    U_WORD,
+    S_WORD,
+    U_DWORD,
+    U_DWORD_R,
+    S_DWORD,
+    S_DWORD_R,
+    FP32,
+    FP32_R,
+};
+
+enum class RawEncoding : uint8_t {
+    NONE,
+    HEXBYTES,
+    COMMA,
+};
+
+// One entity of a read range, offset is in bytes from the start of the
+// response data
+struct SensorItem {
+    ModbusRegisterType register_type;
+    uint16_t start_address;
+    uint8_t register_count;
+    SensorValueType sensor_value_type;
+    uint32_t bitmask;
+    uint16_t response_bytes;
+    RawEncoding encode;
+    uint8_t offset;
+};
+
+class ModbusController;
+
+struct ModbusCommandItem {
+    ModbusController* modbusdevice = nullptr;
+    uint16_t register_address = 0;
+    uint16_t register_count = 0;
+    ModbusFunctionCode function_code = ModbusFunctionCode::READ_HOLDING_REGISTERS;
+    ModbusRegisterType register_type = ModbusRegisterType::HOLDING;
+    std::function<void(ModbusRegisterType, uint16_t, const std::vector<uint8_t>&)> on_data_func;
+    std::vector<uint8_t> payload;
+
+    static ModbusCommandItem create_write_single_command(ModbusController* device, uint16_t address,
+                                                         uint16_t value) {
+        return create_write_multiple_command(device, address, 1, {value}, ModbusFunctionCode::WRITE_SINGLE_REGISTER);
+    }
+
+    static ModbusCommandItem create_write_multiple_command(
+            ModbusController* device, uint16_t address, uint16_t count, const std::vector<uint16_t>& values,
+            ModbusFunctionCode function = ModbusFunctionCode::WRITE_MULTIPLE_REGISTERS) {
+        ModbusCommandItem command;
+        command.modbusdevice = device;
+        command.register_address = address;
+        command.register_count = count;
+        command.function_code = function;
+        for (uint16_t value : values) {
+            command.payload.push_back(value >> 8);
+            command.payload.push_back(value & 0xFF);
+        }
+        return command;
+    }
+};
+
+struct RegisterRange {
+    uint16_t start_address;
+    ModbusRegisterType register_type;
+    uint8_t register_count;
+    uint16_t skip_updates;
+    uint16_t skip_updates_counter;
+};
+
+class ModbusController {
+public:
+    void queue_command(const ModbusCommandItem& command) {
+        command_queue_.push_back(std::unique_ptr<ModbusCommandItem>(new ModbusCommandItem(command)));
+    }
+
+    size_t get_command_queue_length() {
+        return command_queue_.size();
+    }
+
+    void set_update_interval(uint32_t interval) {
+        updateInterval = interval;
+    }
+
+    uint32_t get_update_interval() const {
+        return updateInterval;
+    }
+
+    void start_poller() {}
+
+protected:
+    std::vector<RegisterRange> register_ranges_;
+    std::list<std::unique_ptr<ModbusCommandItem>> command_queue_;
+
+private:
+    uint32_t updateInterval = 60000;
+};
+
+inline uint8_t c_to_hex(char c) {
+    return (c >= 'A') ? (c >= 'a') ? (c - 'a' + 10) : (c - 'A' + 10) : (c - '0');
+}
+
+inline uint8_t byte_from_hex_str(const std::string& value, uint8_t pos) {
+    if (value.length() < pos * 2u + 1) {
+        return 0;
+    }
+    return (c_to_hex(value[pos * 2]) << 4) | c_to_hex(value[pos * 2 + 1]);
+}
+
+inline uint16_t word_from_hex_str(const std::string& value, uint8_t pos) {
+    return byte_from_hex_str(value, pos) << 8 | byte_from_hex_str(value, pos + 1);
+}
+
+}  // namespace modbus_controller
+}  // namespace esphome
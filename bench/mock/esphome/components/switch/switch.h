@@ -0,0 +1,34 @@
+/*
+ * Bench replacement for the ESPHome switch component, only what
+ * heatpump_registers.h uses.
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+namespace esphome {
+namespace switch_ {
+
+class Switch {
+public:
+    bool state = false;
+
+    void add_on_state_callback(std::function<void(bool)>&& callback) {
+        callbacks.push_back(std::move(callback));
+    }
+
+    void publish_state(bool value) {
+        state = value;
+        for (auto& callback : callbacks) {
+            callback(value);
+        }
+    }
+
+private:
+    std::vector<std::function<void(bool)>> callbacks;
+};
+
+}  // namespace switch_
+}  // namespace esphome
@@ -0,0 +1,38 @@
+/*
+ * Bench replacement for the ESPHome uart component, only what
+ * heatpump_bus_stats.h uses.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace uart {
+
+enum UARTDirection {
+    UART_DIRECTION_RX,
+    UART_DIRECTION_TX,
+    UART_DIRECTION_BOTH,
+};
+
+class UARTComponent {
+public:
+    virtual ~UARTComponent() = default;
+
+    void set_baud_rate(uint32_t baud) {
+        baudRate = baud;
+    }
+
+    uint32_t get_baud_rate() const {
+        return baudRate;
+    }
+
+    virtual void load_settings(bool dumpConfig) {}
+
+private:
+    uint32_t baudRate = 9600;
+};
+
+}  // namespace uart
+}  // namespace esphome
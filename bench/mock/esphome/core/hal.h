@@ -0,0 +1,13 @@
+/*
+ * Bench replacement for esphome/core/hal.h, the same clock as the mocked
+ * Arduino core.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace esphome {
+using ::micros;
+using ::millis;
+}  // namespace esphome
@@ -0,0 +1,18 @@
+/*
+ * Simulated time for the bus bench. millis() and micros() of the mocked
+ * Arduino core read this clock, the bench advances it.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+struct SimClock {
+    uint64_t us = 0;
+
+    uint32_t ms() const {
+        return static_cast<uint32_t>(us / 1000);
+    }
+};
+
+inline SimClock simClock;
@@ -9,10 +9,17 @@ import os
 import glob
 import copy
 import re
+import zlib
+import json
+import hashlib
+import argparse
+import contextlib
+import io
+from concurrent.futures import ProcessPoolExecutor
 from ruamel.yaml import YAML
-from ruamel.yaml.scalarstring import LiteralScalarString
+from ruamel.yaml.scalarstring import DoubleQuotedScalarString, LiteralScalarString
 from ruamel.yaml.compat import StringIO
-from ruamel.yaml.comments import CommentedMap
+from ruamel.yaml.comments import CommentedMap, CommentedSeq, TaggedScalar
 
 
 def remove_comments(input):
@@ -39,6 +46,41 @@ def load_yaml(file_path):
         return yaml_data
 
 
+def file_hash(path):
+    with open(path, "rb") as f:
+        return hashlib.sha256(f.read()).hexdigest()
+
+
+# Parsed files by content hash, so a parent model is only parsed once
+parsed_files = {}
+
+
+def load_yaml_cached(file_path):
+    """
+    Parsed YAML of a file, parsed once per content and copied for every
+    caller (the generator changes the data it works on).
+    """
+    digest = file_hash(file_path)
+    if digest not in parsed_files:
+        parsed_files[digest] = load_yaml(file_path)
+    return copy.deepcopy(parsed_files[digest])
+
+
+def write_if_changed(filename, text):
+    """
+    Write the file only when its content changed, so unchanged outputs keep
+    their timestamp and do not trigger an ESPHome recompile. Returns True
+    when the file was written.
+    """
+    if os.path.exists(filename):
+        with open(filename, "r", encoding="utf-8") as f:
+            if f.read() == text:
+                return False
+    with open(filename, "w", encoding="utf-8") as f:
+        f.write(text)
+    return True
+
+
 def save_yaml(data, filename):
     yaml = YAML()
     # yaml.preserve_quotes = True
@@ -52,12 +94,13 @@ def save_yaml(data, filename):
 
     yaml.representer.add_representer(type(None), none_representer)
 
-    with open(filename, "w", encoding="utf-8") as f:
-        yaml.dump(data, f, transform=remove_comments)
+    stream = StringIO()
+    yaml.dump(data, stream, transform=remove_comments)
+    return write_if_changed(filename, stream.getvalue())
 
 
-def apply_overrides(base_data, overrides={}):
-    base = copy.deepcopy(base_data)
+def apply_overrides(base_data, overrides={}, in_place=False):
+    base = base_data if in_place else copy.deepcopy(base_data)
     remove_identifiers = []
 
     # REMOVE per component type
@@ -147,64 +190,1004 @@ def apply_overrides(base_data, overrides={}):
     return base
 
 
+# Polling classes for modbus_controller entities, selected per entity with
+# `poll_class`. The value is the skip_updates of the register range; the
+# substitutions are defined in source/heatpump-base.yaml.
+POLL_CLASSES = {
+    "fast": None,
+    "normal": "${poll_normal_skip}",
+    "slow": "${poll_slow_skip}",
+    "boot": "${poll_boot_skip}",
+}
+DEFAULT_POLL_CLASS = "normal"
+
+# Registers read per entity for the multi-register value types
+VALUE_TYPE_REGISTERS = {
+    "U_DWORD": 2,
+    "S_DWORD": 2,
+    "U_DWORD_R": 2,
+    "S_DWORD_R": 2,
+    "FP32": 2,
+    "FP32_R": 2,
+    "U_QWORD": 4,
+    "S_QWORD": 4,
+    "U_QWORD_R": 4,
+    "S_QWORD_R": 4,
+}
+
+
+def set_entity_key(item, key, value, after="address"):
+    if key in item:
+        item[key] = value
+        return
+    keys = list(item.keys())
+    position = keys.index(after) + 1 if after in keys else len(keys)
+    item.insert(position, key, value)
+
+
+# Read limits of the heat pump controller, a model file can override them
+# with a top-level `read_limits` section (see DEVELOPMENT.md)
+DEFAULT_READ_LIMITS = {
+    # Most registers read with one request
+    "max_registers": 64,
+    # Unused registers that may be read to join two ranges into one request
+    "max_gap": 4,
+    # Register blocks that can be read in one request, inclusive
+    "windows": [[0, 99], [100, 199], [200, 299]],
+}
+
+# Entities that may read extra registers to bridge a gap. Writable entities
+# and raw text sensors use register_count for more than reading.
+BRIDGEABLE_COMPONENTS = ("sensor", "binary_sensor")
+
+
+# Feature profile of a model, a model file can turn features off with a
+# top-level `features` section (see DEVELOPMENT.md)
+DEFAULT_FEATURES = {
+    # Heating zones, entities with `feature: zone_2` need two
+    "zones": 2,
+    # Domestic hot water tank
+    "dhw": True,
+    # Solar kit
+    "solar": True,
+}
+
+
+def feature_enabled(feature, features):
+    zone = re.fullmatch(r"zone_(\d+)", feature)
+    if zone:
+        return int(features["zones"]) >= int(zone.group(1))
+    if feature not in features:
+        print(f"Warning: unknown feature '{feature}', the entity is kept.")
+        return True
+    return bool(features[feature])
+
+
+def item_strings(node):
+    if isinstance(node, dict):
+        for key, value in node.items():
+            yield str(key)
+            yield from item_strings(value)
+    elif isinstance(node, list):
+        for value in node:
+            yield from item_strings(value)
+    elif node is not None:
+        yield str(node)
+
+
+# Keys the read planner looks at, copied for the trial plans of the gap
+# registers
+PLAN_KEYS = ("platform", "modbus_controller_id", "register_type", "address", "value_type",
+             "register_count", "poll_class", "force_new_range")
+
+
+def planned_requests(data, gaps, limits):
+    probe = {}
+    for component_type, items in list(data.items()) + [("sensor", gaps)]:
+        if not isinstance(items, list):
+            continue
+        for item in items:
+            if isinstance(item, dict) and item.get("platform") == "modbus_controller":
+                probe.setdefault(component_type, []).append(CommentedMap((key, item[key]) for key in PLAN_KEYS if key in item))
+    with contextlib.redirect_stdout(io.StringIO()):
+        return len(plan_read_ranges(collect_registers(probe), limits))
+
+
+def gap_register(controller, register_type, address, poll_class):
+    """
+    Internal sensor that reads a register of a dropped entity, so the read
+    request around it does not have to be split.
+    """
+    sensor = CommentedMap()
+    sensor["platform"] = "modbus_controller"
+    sensor["modbus_controller_id"] = DoubleQuotedScalarString(controller)
+    sensor["name"] = DoubleQuotedScalarString(f"register_{address}")
+    sensor["id"] = DoubleQuotedScalarString(f"${{devicename}}_feature_gap_{address}")
+    sensor["internal"] = True
+    sensor["register_type"] = register_type
+    sensor["address"] = address
+    sensor["value_type"] = "U_WORD"
+    sensor["poll_class"] = poll_class
+    sensor["publish"] = "all"
+    sensor["snapshot"] = False
+    return sensor
+
+
+def feature_lists(data):
+    """
+    Lists whose items can have a `feature`: the component lists and the
+    lists inside a component, such as the actions of `api`.
+    """
+    lists = []
+    for key, value in data.items():
+        if isinstance(value, list):
+            lists.append((data, key))
+        elif isinstance(value, dict):
+            lists += [(value, inner) for inner, items in value.items() if isinstance(items, list)]
+    return lists
+
+
+def apply_features(data, features, limits):
+    """
+    Drop the entities (and the globals, scripts, intervals or api actions)
+    with a `feature` that the feature profile of the model turns off. This runs
+    before the read planner, so their registers are not read either.
+
+    A register that is no longer used can split a read request in two when
+    the entity in front of it cannot bridge the gap (numbers, selects and
+    switches write register_count registers). Such registers are still read
+    by an internal sensor when that saves a request.
+    """
+    removed = []
+    dropped_registers = {}
+    for container, component_type in feature_lists(data):
+        items = container[component_type]
+        kept = []
+        for item in items:
+            feature = item.pop("feature", None) if isinstance(item, dict) else None
+            if feature is not None and not feature_enabled(str(feature), features):
+                if "id" in item:
+                    removed.append(str(item["id"]))
+                if item.get("platform") == "modbus_controller" and "address" in item:
+                    count = int(item.get("register_count", VALUE_TYPE_REGISTERS.get(str(item.get("value_type")), 1)))
+                    poll_class = item.get("poll_class", DEFAULT_POLL_CLASS)
+                    for address in range(int(item["address"]), int(item["address"]) + count):
+                        key = (str(item.get("modbus_controller_id")), str(item.get("register_type", "holding")), address)
+                        dropped_registers.setdefault(key, poll_class)
+            else:
+                kept.append(item)
+        if len(kept) != len(items):
+            if kept:
+                container[component_type] = kept
+            else:
+                del container[component_type]
+    for component_type in list(data):
+        # A component whose actions were all dropped, e.g. `api:`
+        if isinstance(data[component_type], dict) and not data[component_type] and component_type != "substitutions":
+            data[component_type] = None
+
+    used = set()
+    for items in data.values():
+        for item in items if isinstance(items, list) else []:
+            if isinstance(item, dict) and item.get("platform") == "modbus_controller" and "address" in item:
+                used.add((str(item.get("modbus_controller_id")), str(item.get("register_type", "holding")), int(item["address"])))
+    gaps = []
+    requests = planned_requests(data, gaps, limits)
+    for key in sorted(set(dropped_registers) - used):
+        gap = gap_register(*key, dropped_registers[key])
+        trial = planned_requests(data, gaps + [gap], limits)
+        if trial < requests:
+            gaps.append(gap)
+            requests = trial
+    if gaps:
+        data.setdefault("sensor", []).extend(gaps)
+
+    # Lambdas and automations of the kept entities must not use the dropped ones
+    patterns = [(entity_id, re.compile(r"(?<!\w)" + re.escape(entity_id) + r"(?!\w)")) for entity_id in removed]
+    for component_type, items in data.items():
+        for item in items if isinstance(items, list) else [items]:
+            text = "\n".join(item_strings(item))
+            for entity_id, pattern in patterns:
+                if pattern.search(text):
+                    owner = item.get("id", component_type) if isinstance(item, dict) else component_type
+                    print(f"Warning: {entity_id} is turned off by the features, but used by {owner}.")
+    return data
+
+
+def collect_registers(data):
+    """
+    Group the modbus_controller entities by register and resolve their
+    `poll_class` into skip_updates.
+
+    ESPHome uses the skip_updates of the first entity of a register range for
+    the whole range. All entities on the same register therefore get the
+    fastest class among them.
+    """
+    order = list(POLL_CLASSES)
+    registers = {}
+
+    for component_type, items in data.items():
+        if not isinstance(items, list):
+            continue
+        for item in items:
+            if not isinstance(item, dict) or "poll_class" not in item and item.get("platform") != "modbus_controller":
+                continue
+            poll_class = item.pop("poll_class", DEFAULT_POLL_CLASS)
+            if item.get("platform") != "modbus_controller" or "address" not in item:
+                print(f"Warning: poll_class on {item.get('id')} in '{component_type}' ignored, not a modbus_controller register.")
+                continue
+            if poll_class not in POLL_CLASSES:
+                print(f"Warning: unknown poll_class '{poll_class}' for {item.get('id')}, using '{DEFAULT_POLL_CLASS}'.")
+                poll_class = DEFAULT_POLL_CLASS
+            if item.get("register_type", "holding") == "custom":
+                continue
+
+            key = (
+                str(item.get("modbus_controller_id")),
+                str(item.get("register_type", "holding")),
+                int(item["address"]),
+            )
+            register = registers.setdefault(
+                key, {"class": poll_class, "count": 1, "bridgeable": True, "force": False, "items": []}
+            )
+            if order.index(poll_class) < order.index(register["class"]):
+                register["class"] = poll_class
+            count = item.get("register_count", VALUE_TYPE_REGISTERS.get(str(item.get("value_type")), 1))
+            register["count"] = max(register["count"], int(count))
+            if component_type not in BRIDGEABLE_COMPONENTS or "register_count" in item:
+                register["bridgeable"] = False
+            if item.get("force_new_range"):
+                register["force"] = True
+            register["items"].append(item)
+
+    for register in registers.values():
+        skip_updates = POLL_CLASSES[register["class"]]
+        if skip_updates is not None:
+            for item in register["items"]:
+                if "skip_updates" not in item:
+                    set_entity_key(item, "skip_updates", skip_updates)
+
+    return registers
+
+
+def plan_read_ranges(registers, limits):
+    """
+    Pack the registers into the fewest read requests.
+
+    A request covers registers of one poll class that lie in one read window,
+    spans at most max_registers and only reads unused registers for gaps of
+    up to max_gap which no other entity uses. Packing greedily from the
+    lowest address gives the minimum number of requests under these limits.
+    """
+    windows = [(int(first), int(last)) for first, last in limits["windows"]]
+
+    def window_of(address):
+        for index, (first, last) in enumerate(windows):
+            if first <= address <= last:
+                return index
+        return None
+
+    ranges = []
+    for controller, register_type in sorted({key[:2] for key in registers}):
+        addresses = sorted(key[2] for key in registers if key[:2] == (controller, register_type))
+        for address in addresses:
+            if window_of(address) is None:
+                print(f"Warning: register {address} is outside the read windows.")
+        for poll_class in POLL_CLASSES:
+            current = None
+            for address in addresses:
+                register = registers[(controller, register_type, address)]
+                if register["class"] != poll_class:
+                    continue
+                end = address + register["count"]
+                if current is not None:
+                    gap = address - current["end"]
+                    last = registers[(controller, register_type, current["addresses"][-1])]
+                    foreign = any(current["end"] <= other < address for other in addresses)
+                    if (
+                        not register["force"]
+                        and window_of(address) == current["window"]
+                        and end - current["start"] <= int(limits["max_registers"])
+                        and 0 <= gap <= int(limits["max_gap"])
+                        and (gap == 0 or last["bridgeable"])
+                        and not foreign
+                    ):
+                        current["end"] = end
+                        current["addresses"].append(address)
+                        continue
+                    ranges.append(current)
+                current = {
+                    "controller": controller,
+                    "register_type": register_type,
+                    "class": poll_class,
+                    "window": window_of(address),
+                    "start": address,
+                    "end": end,
+                    "addresses": [address],
+                }
+            if current is not None:
+                ranges.append(current)
+
+    ranges.sort(key=lambda r: (r["controller"], r["register_type"], r["start"]))
+    return ranges
+
+
+def apply_read_plan(registers, ranges):
+    """
+    Make ESPHome build exactly the planned ranges: extend the register before
+    a bridged gap with register_count and start every range that directly
+    follows another register with force_new_range.
+    """
+    ends = {}
+    for key, register in registers.items():
+        ends.setdefault(key[:2], set()).add(key[2] + register["count"])
+
+    for rng in ranges:
+        group = (rng["controller"], rng["register_type"])
+        for address, following in zip(rng["addresses"], rng["addresses"][1:]):
+            register = registers[group + (address,)]
+            if following > address + register["count"]:
+                for item in register["items"]:
+                    set_entity_key(item, "register_count", following - address)
+        if rng["start"] in ends[group]:
+            set_entity_key(registers[group + (rng["start"],)]["items"][0], "force_new_range", True)
+
+
+def read_plan_comment(ranges, limits):
+    lines = [
+        "Modbus read plan, generated by model-generator.py from the poll classes",
+        f"and read limits (max {limits['max_registers']} registers per request, gaps up to",
+        f"{limits['max_gap']} registers bridged). One line per read request:",
+        "  Registers    Count  Class   Entities",
+    ]
+    for rng in ranges:
+        entities = sum(len(registers_items) for registers_items in rng["entities"])
+        span = f"{rng['start']}-{rng['end'] - 1}" if rng["end"] - rng["start"] > 1 else f"{rng['start']}"
+        lines.append(f"  {span:<12} {rng['end'] - rng['start']:>5}  {rng['class']:<7} {entities}")
+    for poll_class in POLL_CLASSES:
+        count = sum(1 for rng in ranges if rng["class"] == poll_class)
+        if count:
+            lines.append(f"  {poll_class}: {count} request(s)")
+    return "\n".join(lines)
+
+
+def range_stats_sensors(ranges):
+    """
+    One diagnostic text sensor per planned read range with its bus
+    statistics (see models/heatpump_bus_stats.h), disabled by default.
+    """
+    sensors = []
+    for rng in ranges:
+        span = f"{rng['start']}-{rng['end'] - 1}" if rng["end"] - rng["start"] > 1 else f"{rng['start']}"
+        sensor = CommentedMap()
+        sensor["platform"] = "template"
+        sensor["name"] = DoubleQuotedScalarString(f"Modbus Range {span}")
+        sensor["id"] = DoubleQuotedScalarString(f"${{devicename}}_modbus_range_{rng['start']}")
+        sensor["icon"] = "mdi:chart-box-outline"
+        sensor["entity_category"] = "diagnostic"
+        sensor["disabled_by_default"] = True
+        sensor["update_interval"] = "60s"
+        sensor["lambda"] = LiteralScalarString(f"return bus_stats.rangeSummary({rng['start']});")
+        sensors.append(sensor)
+    return sensors
+
+
+def apply_read_planner(data, limits):
+    registers = collect_registers(data)
+    ranges = plan_read_ranges(registers, limits)
+    for rng in ranges:
+        group = (rng["controller"], rng["register_type"])
+        rng["entities"] = [registers[group + (address,)]["items"] for address in rng["addresses"]]
+        # Before apply_read_plan stretches registers over the bridged gaps
+        rng["counts"] = [registers[group + (address,)]["count"] for address in rng["addresses"]]
+    apply_read_plan(registers, ranges)
+    if "modbus_controller" in data:
+        data.yaml_set_comment_before_after_key("modbus_controller", before=read_plan_comment(ranges, limits))
+    if "text_sensor" in data:
+        data["text_sensor"].extend(range_stats_sensors(ranges))
+    return data, ranges
+
+
+# Sensor platforms that get the publish filter
+PUBLISH_FILTER_PLATFORMS = ("modbus_controller", "template")
+
+
+def append_filter(item, sensor_filter):
+    filters = item.get("filters")
+    if filters is None:
+        filters = CommentedSeq()
+        item["filters"] = filters
+    # Drop the blank line after the last filter of a model file override,
+    # it would end up in the middle of the filters
+    if filters and isinstance(filters[-1], CommentedMap) and filters[-1]:
+        filters[-1].ca.items.pop(list(filters[-1].keys())[-1], None)
+    filters.append(sensor_filter)
+
+
+def merge_publish_filters(settings, overrides):
+    """
+    Merge a `publish_filters` section into the settings, per device class.
+    """
+    for device_class, values in (overrides or {}).items():
+        settings.setdefault(str(device_class), {}).update(values)
+    return settings
+
+
+def publish_filter(delta, heartbeat):
+    """
+    ESPHome filter that passes a value when it changed by more than delta, or
+    when the last published value is older than heartbeat.
+    """
+    throttle = CommentedMap()
+    throttle["throttle"] = heartbeat
+    change = CommentedMap()
+    change["delta"] = delta
+    either = CommentedMap()
+    either["or"] = CommentedSeq([throttle, change])
+    return either
+
+
+def apply_publish_filters(data, settings):
+    """
+    Add the change-only publish filter to the modbus_controller and template
+    sensors. The delta and
+    heartbeat come from the device class in `publish_filters`, an entity
+    can override them with `publish` or turn the filter off with
+    `publish: all`.
+    """
+    for item in data.get("sensor", []):
+        if not isinstance(item, dict):
+            continue
+        publish = item.pop("publish", None)
+        if item.get("platform") not in PUBLISH_FILTER_PLATFORMS:
+            continue
+        if publish == "all":
+            continue
+        values = dict(settings.get("default", {}))
+        values.update(settings.get(str(item.get("device_class")), {}))
+        if isinstance(publish, dict):
+            values.update(publish)
+        elif publish is not None:
+            print(f"Warning: unknown publish '{publish}' for {item.get('id')}, using the defaults.")
+        if "delta" not in values or "heartbeat" not in values:
+            continue
+        append_filter(item, publish_filter(values["delta"], values["heartbeat"]))
+    return data
+
+
+def merge_enums(tables, overrides):
+    """
+    Merge an `enums` section into the enum tables, a table of a model file
+    replaces the table with the same name.
+    """
+    for name, table in (overrides or {}).items():
+        tables[str(name)] = table
+    return tables
+
+
+def enum_symbol(name):
+    return "ENUM_" + re.sub(r"\W", "_", name).upper()
+
+
+def c_string(text):
+    return '"' + str(text).replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+def enum_header(model_name, tables):
+    """
+    C++ header with one constexpr array per enum table, sorted by value for
+    the binary search of enumLookup() (see models/heatpump_registers.h).
+    """
+    lines = [
+        f"// Generated by model-generator.py for the {model_name} model from the",
+        "// `enums` sections of the model files, do not edit",
+        "",
+        "#pragma once",
+        "",
+        '#include "heatpump_registers.h"',
+    ]
+    for name, table in tables.items():
+        entries = sorted((int(value), text) for value, text in table.items())
+        lines.append("")
+        lines.append(f"constexpr EnumEntry {enum_symbol(name)}[] = {{")
+        lines += [f"    {{{value}, {c_string(text)}}}," for value, text in entries]
+        lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def apply_enums(data, tables, header):
+    """
+    Fill the optionsmap of the selects with `enum: <table>` from the table,
+    in the order of the table, and include the generated header with the
+    tables, so the lambdas can look the texts up with enumLookup() and
+    enumText().
+    """
+    for item in data.get("select", []):
+        if not isinstance(item, dict) or "enum" not in item:
+            continue
+        position = list(item.keys()).index("enum")
+        name = str(item.pop("enum"))
+        if name not in tables:
+            print(f"Warning: unknown enum '{name}' for {item.get('id')}.")
+            continue
+        options = CommentedMap()
+        for value, text in tables[name].items():
+            options[DoubleQuotedScalarString(text)] = int(value)
+        item.insert(position, "optionsmap", options)
+    if tables and "esphome" in data:
+        data["esphome"].setdefault("includes", CommentedSeq()).append(header)
+    return data
+
+
+# Components whose entities can show one bit of a cached register
+REGISTER_FLAG_COMPONENTS = ("switch", "binary_sensor")
+
+
+def apply_register_flags(data):
+    """
+    Bind the entities with `register_flag: {address: ..., mask: ...}` to the
+    register cache at boot (see RegisterFlags in models/heatpump_registers.h),
+    with one bind() call per entity instead of lambdas.
+    """
+    lines = []
+    for component_type in REGISTER_FLAG_COMPONENTS:
+        for item in data.get(component_type, []):
+            if not isinstance(item, dict) or "register_flag" not in item:
+                continue
+            flag = item.pop("register_flag")
+            lines.append(f"register_flags.bind(id({item['id']}), 0x{int(flag['address']):X}, 0x{int(flag['mask']):X});")
+    if lines and "esphome" in data:
+        add_on_boot(data, -100, lines)
+    return data
+
+
+# Polling classes whose states are kept in the state snapshot (see
+# models/heatpump_registers.h) and the code to save and restore them
+SNAPSHOT_POLL_CLASSES = ("slow", "boot")
+SNAPSHOT_COMPONENTS = {
+    "sensor": ("snapshotSave", "snapshotRestore"),
+    "number": ("snapshotSave", "snapshotRestore"),
+    "binary_sensor": ("snapshotSave", "snapshotRestore"),
+    "select": ("snapshotSaveIndex", "snapshotRestoreIndex"),
+}
+
+
+def snapshot_entities(data):
+    classes = [POLL_CLASSES[poll_class] for poll_class in SNAPSHOT_POLL_CLASSES]
+    entities = []
+    for component_type in SNAPSHOT_COMPONENTS:
+        for item in data.get(component_type, []):
+            if not isinstance(item, dict) or not item.pop("snapshot", True):
+                continue
+            if "id" in item and item.get("skip_updates") in classes:
+                entities.append((component_type, str(item["id"])))
+    return entities
+
+
+def apply_state_snapshot(data):
+    """
+    Keep the states of the slow and boot class entities in a restored global.
+    They are saved every minute (the global is only written to flash when a
+    state changed) and published again at boot, before the deferred slow and
+    boot ranges are read.
+    """
+    entities = snapshot_entities(data)
+    if not entities or "esphome" not in data:
+        return data
+    layout = zlib.crc32(" ".join(f"{c}:{i}" for c, i in entities).encode()) or 1
+
+    save = ["auto &snapshot = id(state_snapshot);", f"snapshot.layout = {layout}u;"]
+    restore = [
+        "auto &snapshot = id(state_snapshot);",
+        f"if (snapshot.layout == {layout}u) {{",
+    ]
+    for index, (component_type, entity_id) in enumerate(entities):
+        save_function, restore_function = SNAPSHOT_COMPONENTS[component_type]
+        save.append(f"{save_function}(snapshot.values[{index}], id({entity_id}));")
+        restore.append(f"  {restore_function}(snapshot.values[{index}], id({entity_id}));")
+    restore += [
+        "  deferRanges(${devicename}, ${poll_slow_skip}, ${snapshot_defer_updates});",
+        "}",
+    ]
+
+    snapshot = CommentedMap()
+    snapshot["id"] = "state_snapshot"
+    snapshot["type"] = f"StateSnapshot<{len(entities)}>"
+    snapshot["restore_value"] = "yes"
+    data.setdefault("globals", CommentedSeq()).insert(0, snapshot)
+
+    add_on_boot(data, -100, restore)
+    add_interval(data, "60s", save)
+    return data
+
+
+# Modbus read function per register type, for the state endpoint
+STATE_FUNCTIONS = {"holding": 3, "read": 4}
+STATE_HEADER_SIZE = 12
+
+
+def state_scale(item):
+    if "multiply" in item:
+        return item["multiply"]
+    filters = item.get("filters") or []
+    if filters and isinstance(filters[0], dict) and "multiply" in filters[0]:
+        return filters[0]["multiply"]
+    return None
+
+
+def state_schema(model_name, ranges, data):
+    """
+    Byte layout of /state.bin (see models/heatpump_state.h): every planned
+    read range and the entities in it, with what a poller needs to decode
+    them.
+    """
+    components = {id(item): component_type for component_type, items in data.items()
+                  if isinstance(items, list) for item in items}
+    schema_ranges = []
+    entities = []
+    offset = STATE_HEADER_SIZE
+    for rng in ranges:
+        function = STATE_FUNCTIONS.get(rng["register_type"])
+        if function is None:
+            continue
+        count = rng["end"] - rng["start"]
+        schema_ranges.append({"function": function, "start": rng["start"], "count": count, "offset": offset})
+        for address, items, registers in zip(rng["addresses"], rng["entities"], rng["counts"]):
+            for item in items:
+                if item.get("internal"):
+                    continue
+                entity = {
+                    "id": str(item["id"]).replace("${devicename}_", ""),
+                    "name": str(item.get("name", "")),
+                    "component": components.get(id(item), ""),
+                    "function": function,
+                    "address": address,
+                    "offset": offset + 4 + (address - rng["start"]) * 2,
+                    "registers": registers,
+                    "value_type": str(item.get("value_type", "U_WORD")),
+                }
+                if "bitmask" in item:
+                    entity["bitmask"] = int(item["bitmask"])
+                if "unit_of_measurement" in item:
+                    entity["unit"] = str(item["unit_of_measurement"])
+                scale = state_scale(item)
+                if scale is not None:
+                    entity["multiply"] = float(scale)
+                if "lambda" in item:
+                    # Decoded by a lambda of the model file
+                    entity["lambda"] = True
+                if "optionsmap" in item:
+                    entity["options"] = {str(value): str(text) for text, value in item["optionsmap"].items()}
+                entities.append(entity)
+        offset += 4 + count * 2
+    schema = {"ranges": schema_ranges, "entities": entities}
+    layout = zlib.crc32(json.dumps(schema, sort_keys=True).encode()) or 1
+    return {"model": model_name, "magic": "HPS1", "layout": layout, "size": offset, **schema}
+
+
+def apply_state_endpoint(data, schema):
+    """
+    Set up the raw register snapshot served as /state.bin (see
+    models/heatpump_state.h) with the ranges of the read plan, fed by the
+    bus statistics.
+    """
+    if not schema["ranges"] or "esphome" not in data:
+        return data
+    lines = [f"state_endpoint.configure({schema['layout']}u);"]
+    for rng in schema["ranges"]:
+        lines.append(f"state_endpoint.addRange({rng['function']}, {rng['start']}, {rng['count']});")
+    lines += [
+        "state_endpoint.attach();",
+        "bus_stats.onRead = [](uint8_t function, uint16_t start, uint16_t count, const uint8_t* data, uint32_t now) {",
+        "  state_endpoint.update(function, start, count, data, now);",
+        "};",
+    ]
+    add_on_boot(data, -100, lines)
+    return data
+
+
+# Batched MQTT publishing, turned on per model with `mqtt_batch`
+DEFAULT_MQTT_BATCH = {
+    "enabled": False,
+    "topic": "${devicename}/batch",
+}
+MQTT_BATCH_HEADER = "heatpump_mqtt.h"
+
+
+def secret(name):
+    return TaggedScalar(value=name, tag="!secret")
+
+
+def apply_mqtt_batch(data, settings):
+    """
+    Publish the changed sensor values of every poll cycle as one MQTT
+    message (see models/heatpump_mqtt.h) instead of one state topic per
+    sensor. Adds the MQTT client, turns off the state topics of the batched
+    sensors and feeds them into the batch behind their publish filter.
+    """
+    if not settings.get("enabled") or "esphome" not in data:
+        return data
+    names = []
+    for item in data.get("sensor", []):
+        if not isinstance(item, dict) or item.get("platform") not in PUBLISH_FILTER_PLATFORMS:
+            continue
+        if "id" not in item or item.get("internal"):
+            continue
+        channel = len(names)
+        names.append(str(item["id"]).replace("${devicename}_", ""))
+        batch = CommentedMap([("lambda", LiteralScalarString(f"mqtt_batch.add({channel}, x, millis());\nreturn x;"))])
+        append_filter(item, batch)
+        item["state_topic"] = DoubleQuotedScalarString("")
+    if not names:
+        return data
+
+    if "mqtt" not in data:
+        mqtt = CommentedMap()
+        mqtt["broker"] = secret("mqtt_broker")
+        mqtt["username"] = secret("mqtt_username")
+        mqtt["password"] = secret("mqtt_password")
+        # The batched sensors have no state topics to discover
+        mqtt["discovery"] = False
+        data["mqtt"] = mqtt
+    data["esphome"].setdefault("includes", CommentedSeq()).append(MQTT_BATCH_HEADER)
+
+    configure = ["static const char* const names[] = {"]
+    configure += [f'  "{name}",' for name in names]
+    configure += ["};", f'mqtt_batch.configure(names, {len(names)}, "{settings["topic"]}");']
+    add_on_boot(data, -100, configure)
+    add_interval(data, "100ms", ["mqtt_batch.service(bus_stats.cycles, millis());"])
+    return data
+
+
+def lambda_action(lines):
+    return CommentedSeq([CommentedMap([("lambda", LiteralScalarString("\n".join(lines)))])])
+
+
+def add_on_boot(data, priority, lines):
+    on_boot = CommentedMap()
+    on_boot["priority"] = priority
+    on_boot["then"] = lambda_action(lines)
+    triggers = data["esphome"].get("on_boot", CommentedSeq())
+    if not isinstance(triggers, list):
+        triggers = CommentedSeq([triggers])
+    triggers.insert(0, on_boot)
+    data["esphome"]["on_boot"] = triggers
+
+
+def add_interval(data, period, lines):
+    interval = CommentedMap()
+    interval["interval"] = period
+    interval["then"] = lambda_action(lines)
+    data.setdefault("interval", CommentedSeq()).append(interval)
+
+
+# Downsampled sensors of a traced sensor: name suffix and TraceStats field
+TRACE_STATS = (("Min", "min"), ("Max", "max"), ("Mean", "mean"))
+TRACE_COPY_KEYS = ("unit_of_measurement", "device_class", "accuracy_decimals", "icon")
+
+
+def apply_sample_trace(data):
+    """
+    Feed the sensors with `trace: true` into the sample trace (see
+    models/heatpump_trace.h) and add min, max and mean sensors for them,
+    published every ${trace_stats_interval}.
+    """
+    sensors = data.get("sensor", [])
+    traced = []
+    for item in sensors:
+        if isinstance(item, dict) and item.pop("trace", False):
+            if len(traced) == 8:
+                print(f"Warning: trace on {item.get('id')} ignored, at most 8 sensors can be traced.")
+                continue
+            traced.append(item)
+    if not traced or "esphome" not in data:
+        return data
+
+    names = ["sample_trace.attach();"]
+    publish = []
+    for channel, item in enumerate(traced):
+        entity_id = str(item["id"])
+        trace = CommentedMap([("lambda", LiteralScalarString(f"sample_trace.add({channel}, x, millis());\nreturn x;"))])
+        append_filter(item, trace)
+        names.append(f'sample_trace.setName({channel}, "{entity_id.replace("${devicename}_", "")}");')
+
+        publish.append(f"stats = sample_trace.takeStats({channel});")
+        publish.append("if (!std::isnan(stats.mean)) {")
+        for suffix, field in TRACE_STATS:
+            sensor = CommentedMap()
+            sensor["platform"] = "template"
+            sensor["name"] = DoubleQuotedScalarString(f"{item['name']} {suffix}")
+            sensor["id"] = DoubleQuotedScalarString(f"{entity_id}_{field}")
+            for key in TRACE_COPY_KEYS:
+                if key in item:
+                    sensor[key] = item[key]
+            sensor["state_class"] = "measurement"
+            sensor["entity_category"] = "diagnostic"
+            sensor["disabled_by_default"] = True
+            sensor["update_interval"] = "never"
+            sensors.append(sensor)
+            publish.append(f"  id({entity_id}_{field}).publish_state(stats.{field});")
+        publish.append("}")
+
+    add_on_boot(data, -100, names)
+    add_interval(data, "${trace_stats_interval}", ["TraceStats stats;"] + publish)
+    return data
+
+
+def inheritance_files(model_file, override_dir):
+    """
+    Files of the inheritance chain of a model file, from the most general to
+    the model file itself.
+    """
+    parent_name = load_yaml_cached(model_file).get("parent")
+    if parent_name is None:
+        return [model_file]
+    parent_file = os.path.join(override_dir, parent_name)
+
+    # Validate parent file exists
+    if not os.path.exists(parent_file):
+        raise FileNotFoundError(
+            f"Parent model '{parent_name}' not found in {override_dir}"
+        )
+    return inheritance_files(parent_file, override_dir) + [model_file]
+
+
 def resolve_inheritance_chain(model_file, override_dir):
     """
     Resolve the inheritance chain for a model file.
     Returns a list of override dictionaries in order from most general to most specific.
     """
-    # Load current model
-    overrides = load_yaml(model_file)
+    chain = []
+    for file_path in inheritance_files(model_file, override_dir):
+        overrides = load_yaml_cached(file_path)
+        # 'parent' is not an operation
+        overrides.pop("parent", None)
+        chain.append(overrides)
+    return chain
 
-    # Check if this model has a parent
-    if "parent" in overrides:
-        parent_name = overrides["parent"]
-        parent_file = os.path.join(override_dir, parent_name)
 
-        # Validate parent file exists
-        if not os.path.exists(parent_file):
-            raise FileNotFoundError(
-                f"Parent model '{parent_name}' not found in {override_dir}"
-            )
+BASE_FILE = "source/heatpump-base.yaml"
+OVERRIDE_DIR = "source/models"
+OUTPUT_DIR = "models"
 
-        # Recursively resolve parent chain
-        parent_chain = resolve_inheritance_chain(parent_file, override_dir)
+# Input hashes and output hashes of the last run, per model
+CACHE_FILE = ".model-generator-cache.json"
 
-        # Remove 'parent' key from current overrides as it's not an operation
-        overrides_copy = copy.deepcopy(overrides)
-        overrides_copy.pop("parent", None)
+# Parsed base file with its publish filters and enum tables, loaded once per
+# process (forked workers get it from the main process)
+base_inputs = None
 
-        # Return chain: [...grandparents, parent, child]
-        return parent_chain + [overrides_copy]
-    else:
-        # No parent, return just this model's overrides
-        return [overrides]
 
+def load_base():
+    global base_inputs
+    if base_inputs is None:
+        base_data = load_yaml(BASE_FILE)
+        base_publish_filters = merge_publish_filters({}, base_data.pop("publish_filters", None))
+        base_enums = merge_enums({}, base_data.pop("enums", None))
+        base_inputs = (base_data, base_publish_filters, base_enums)
+    return base_inputs
 
-def main():
-    base_file = "source/heatpump-base.yaml"
-    override_dir = "source/models"
-    output_dir = "models"
 
-    os.makedirs(output_dir, exist_ok=True)
+def generate_model(override_file):
+    """
+    Write the output files of one model. Returns (file, written) per output
+    file.
+    """
+    base_data, base_publish_filters, base_enums = load_base()
+    model_name = os.path.splitext(os.path.basename(override_file))[0]
+
+    # Resolve inheritance chain
+    inheritance_chain = resolve_inheritance_chain(override_file, OVERRIDE_DIR)
+
+    # Apply overrides in order from parent to child, on one copy of the base
+    merged_data = copy.deepcopy(base_data)
+    for overrides in inheritance_chain:
+        merged_data = apply_overrides(merged_data, overrides, in_place=True)
+    read_limits = copy.deepcopy(DEFAULT_READ_LIMITS)
+    for overrides in inheritance_chain:
+        read_limits.update(overrides.get("read_limits", {}))
+    features = dict(DEFAULT_FEATURES)
+    for overrides in inheritance_chain:
+        features.update(overrides.get("features", {}))
+    mqtt_batch = dict(DEFAULT_MQTT_BATCH)
+    for overrides in inheritance_chain:
+        mqtt_batch.update(overrides.get("mqtt_batch", {}))
+    merged_data = apply_features(merged_data, features, read_limits)
+    merged_data, read_ranges = apply_read_planner(merged_data, read_limits)
+    publish_filters = copy.deepcopy(base_publish_filters)
+    for overrides in inheritance_chain:
+        merge_publish_filters(publish_filters, overrides.get("publish_filters"))
+    enums = copy.deepcopy(base_enums)
+    for overrides in inheritance_chain:
+        merge_enums(enums, overrides.get("enums"))
+    enum_file = f"{model_name}-enums.h"
+    merged_data = apply_enums(merged_data, enums, enum_file)
+    merged_data = apply_register_flags(merged_data)
+    schema = state_schema(model_name, read_ranges, merged_data)
+    merged_data = apply_state_endpoint(merged_data, schema)
+    merged_data = apply_sample_trace(merged_data)
+    merged_data = apply_publish_filters(merged_data, publish_filters)
+    merged_data = apply_mqtt_batch(merged_data, mqtt_batch)
+    merged_data = apply_state_snapshot(merged_data)
+
+    output_file = os.path.join(OUTPUT_DIR, f"{model_name}.yaml")
+    outputs = [(output_file, save_yaml(merged_data, output_file))]
+    if enums:
+        header_file = os.path.join(OUTPUT_DIR, enum_file)
+        outputs.append((header_file, write_if_changed(header_file, enum_header(model_name, enums))))
+    if schema["ranges"]:
+        schema_file = os.path.join(OUTPUT_DIR, f"{model_name}-state.json")
+        outputs.append((schema_file, write_if_changed(schema_file, json.dumps(schema, indent=2) + "\n")))
+    return outputs
 
-    base_data = load_yaml(base_file)
 
-    override_files = glob.glob(os.path.join(override_dir, "*.yaml"))
+def input_hash(files):
+    """
+    Hash of everything a model is generated from: this script, the base file
+    and the files of its inheritance chain.
+    """
+    digest = hashlib.sha256()
+    for file_path in [os.path.abspath(__file__), BASE_FILE] + files:
+        digest.update(file_hash(file_path).encode())
+    return digest.hexdigest()
+
+
+def up_to_date(entry, inputs):
+    if entry is None or entry.get("inputs") != inputs:
+        return False
+    return all(
+        os.path.exists(file_path) and file_hash(file_path) == digest
+        for file_path, digest in entry.get("outputs", {}).items()
+    )
+
+
+def load_cache():
+    try:
+        with open(CACHE_FILE, "r") as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return {}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the model files in models/ from source/")
+    parser.add_argument("--force", action="store_true", help="regenerate every model, ignoring the cache")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count() or 1, help="models generated in parallel")
+    args = parser.parse_args()
+
+    os.makedirs(OUTPUT_DIR, exist_ok=True)
 
-    for override_file in override_files:
+    cache = {} if args.force else load_cache()
+    next_cache = {}
+    stale = []
+    for override_file in sorted(glob.glob(os.path.join(OVERRIDE_DIR, "*.yaml"))):
         model_name = os.path.splitext(os.path.basename(override_file))[0]
+        inputs = input_hash(inheritance_files(override_file, OVERRIDE_DIR))
+        if up_to_date(cache.get(model_name), inputs):
+            print(f"Up to date: {model_name}")
+            next_cache[model_name] = cache[model_name]
+        else:
+            stale.append((model_name, override_file, inputs))
 
-        # Resolve inheritance chain
-        inheritance_chain = resolve_inheritance_chain(override_file, override_dir)
+    jobs = max(1, min(args.jobs, len(stale)))
+    if jobs > 1:
+        # Parse the base before the workers are started, so they share it
+        load_base()
+        with ProcessPoolExecutor(max_workers=jobs) as pool:
+            results = list(pool.map(generate_model, [override_file for _, override_file, _ in stale]))
+    else:
+        results = [generate_model(override_file) for _, override_file, _ in stale]
 
-        # Apply overrides in order from parent to child
-        merged_data = base_data
-        for overrides in inheritance_chain:
-            merged_data = apply_overrides(merged_data, overrides)
+    for (model_name, _, inputs), outputs in zip(stale, results):
+        for output_file, written in outputs:
+            print(f"{'Created' if written else 'Unchanged'}: {output_file}")
+        next_cache[model_name] = {
+            "inputs": inputs,
+            "outputs": {output_file: file_hash(output_file) for output_file, _ in outputs},
+        }
 
-        output_file = os.path.join(output_dir, f"{model_name}.yaml")
-        save_yaml(merged_data, output_file)
-        print(f"Created: {output_file}")
+    with open(CACHE_FILE, "w") as f:
+        json.dump(next_cache, f, indent=2, sort_keys=True)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,473 @@
+/*
+ * Heat Pump Modbus Bus Statistics
+ * Running counters for the Modbus link, fed with the raw bytes from the
+ * uart debug callback.
+ *
+ * Requests and responses are matched by their position on the bus. A
+ * response is complete once it reaches the length the request asks for
+ * (or 5 bytes for an exception), so it does not matter how the uart
+ * debugger splits the bytes. Per read range (start address of the request)
+ * the requests, exceptions, CRC errors, timeouts and a round-trip latency
+ * histogram are kept. A request that gets no complete response before the
+ * next request counts as a timeout.
+ *
+ * A cycle starts with the first request after the controller queue was
+ * empty, and ends when the queue is empty again.
+ *
+ * Every valid read response is handed to onRead with the function, range
+ * and register bytes of its request (the state endpoint keeps its raw
+ * snapshot with it, see heatpump_state.h).
+ *
+ * The link profile optionally runs the RS-485 link at a higher baud rate.
+ * The heat pump answers at the one rate set on the unit, so the fast rate
+ * only works once the unit itself was set to it; the ESP cannot change
+ * that setting. The link starts at the fast rate, checks the error rate of
+ * the first requests and falls back to the base rate (9600, the unit
+ * default) if too many fail, so a unit that was not reconfigured still
+ * works. At the fast rate, the response timeout (Modbus send_wait_time) is
+ * tuned to the slowest response measured, and the error rate is checked for
+ * as long as it runs.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "esphome/components/modbus/modbus.h"
+#include "esphome/components/uart/uart.h"
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+// Number of read ranges tracked, further ranges only count in the totals
+#ifndef BUS_STATS_RANGES
+#define BUS_STATS_RANGES 32
+#endif
+
+// Latency histogram: BUS_STATS_BUCKETS buckets of BUS_STATS_BUCKET_MS, the
+// last bucket also holds everything slower
+#ifndef BUS_STATS_BUCKET_MS
+#define BUS_STATS_BUCKET_MS 10
+#endif
+#define BUS_STATS_BUCKETS 32
+
+// Longest Modbus RTU frame
+#define BUS_STATS_MAX_FRAME 256
+
+// Link profile: judge the fast rate after LINK_CHECK_REQUESTS requests (or
+// LINK_CHECK_TIMEOUT_MS) and go back to the base rate above
+// LINK_MAX_ERROR_PERCENT CRC errors and timeouts
+#ifndef LINK_CHECK_REQUESTS
+#define LINK_CHECK_REQUESTS 50
+#endif
+#ifndef LINK_CHECK_TIMEOUT_MS
+#define LINK_CHECK_TIMEOUT_MS 60000
+#endif
+#ifndef LINK_MAX_ERROR_PERCENT
+#define LINK_MAX_ERROR_PERCENT 5
+#endif
+
+// Response timeout at the fast rate: slowest response plus this margin, but
+// not below LINK_MIN_SEND_WAIT_MS or above the configured send_wait_time
+#ifndef LINK_SEND_WAIT_MARGIN_MS
+#define LINK_SEND_WAIT_MARGIN_MS 40
+#endif
+#ifndef LINK_MIN_SEND_WAIT_MS
+#define LINK_MIN_SEND_WAIT_MS 80
+#endif
+
+// ============================================================================
+// Latency Histogram
+// ============================================================================
+
+class LatencyHistogram {
+public:
+    uint32_t max = 0;
+
+    void reset() {
+        *this = LatencyHistogram();
+    }
+
+    void add(uint32_t ms) {
+        uint32_t bucket = ms / BUS_STATS_BUCKET_MS;
+        if (bucket >= BUS_STATS_BUCKETS) {
+            bucket = BUS_STATS_BUCKETS - 1;
+        }
+        if (counts[bucket] == UINT16_MAX) {
+            // Halve everything, keeps the shape and favours recent values
+            for (auto& count : counts) {
+                count /= 2;
+            }
+        }
+        counts[bucket]++;
+        if (ms > max) {
+            max = ms;
+        }
+    }
+
+    // Median, at bucket resolution (middle of the bucket, at most max)
+    uint32_t p50() const {
+        uint32_t total = 0;
+        for (auto count : counts) {
+            total += count;
+        }
+        if (total == 0) {
+            return 0;
+        }
+        uint32_t seen = 0;
+        for (uint8_t i = 0; i < BUS_STATS_BUCKETS; i++) {
+            seen += counts[i];
+            if (seen * 2 >= total) {
+                uint32_t middle = i * BUS_STATS_BUCKET_MS + BUS_STATS_BUCKET_MS / 2;
+                return middle < max ? middle : max;
+            }
+        }
+        return max;
+    }
+
+private:
+    uint16_t counts[BUS_STATS_BUCKETS] = {};
+};
+
+// ============================================================================
+// Bus Statistics
+// ============================================================================
+
+class ModbusBusStats {
+public:
+    // Totals over all requests
+    uint32_t requests = 0;
+    uint32_t exceptions = 0;
+    uint32_t crcErrors = 0;
+    uint32_t timeouts = 0;
+    uint8_t lastException = 0;
+    LatencyHistogram latency;
+    LatencyHistogram recent;  // Since the last recent.reset(), for the link profile
+
+    // Duration of the last completed cycle and completed cycles since boot
+    uint32_t cycleMs = 0;
+    uint32_t cycles = 0;
+
+    // Valid read response: function, first register, register count and
+    // the register bytes (big endian, as on the wire)
+    std::function<void(uint8_t function, uint16_t start, uint16_t count, const uint8_t* data, uint32_t now)> onRead;
+
+    // Bytes from the uart debug callback
+    void onBytes(bool tx, const std::vector<uint8_t>& bytes, uint32_t now) {
+        if (tx) {
+            onRequest(bytes, now);
+        } else {
+            onResponse(bytes, now);
+        }
+    }
+
+    // Controller queue length, called from an interval
+    void service(size_t queueLength, uint32_t now) {
+        if (queueLength > queueDepthMax) {
+            queueDepthMax = queueLength;
+        }
+        if (cycleActive && queueLength == 0 && !awaiting) {
+            cycleMs = (lastResponseAt != 0 ? lastResponseAt : now) - cycleStart;
+            if (cycleMs > cycleMaxMs) {
+                cycleMaxMs = cycleMs;
+            }
+            cycleActive = false;
+            cycles++;
+        }
+    }
+
+    // Highest value since the last call, for sensors that report a window
+    uint32_t takeCycleMax() {
+        uint32_t value = cycleMaxMs;
+        cycleMaxMs = 0;
+        return value;
+    }
+
+    size_t takeQueueDepthMax() {
+        size_t value = queueDepthMax;
+        queueDepthMax = 0;
+        return value;
+    }
+
+    // "p50 45ms max 62ms req 120 exc 0 crc 0 tmo 1" for the range that
+    // starts at this address
+    std::string rangeSummary(uint16_t start) const {
+        const Range* range = find(start);
+        if (range == nullptr) {
+            return "no requests";
+        }
+        char text[96];
+        snprintf(text, sizeof(text), "p50 %ums max %ums req %u exc %u crc %u tmo %u",
+                 (unsigned) range->latency.p50(), (unsigned) range->latency.max, (unsigned) range->requests,
+                 (unsigned) range->exceptions, (unsigned) range->crcErrors, (unsigned) range->timeouts);
+        return text;
+    }
+
+private:
+    struct Range {
+        uint16_t start;
+        uint32_t requests;
+        uint32_t exceptions;
+        uint32_t crcErrors;
+        uint32_t timeouts;
+        LatencyHistogram latency;
+    };
+
+    Range ranges[BUS_STATS_RANGES];
+    uint8_t rangeCount = 0;
+
+    // Request waiting for its response
+    bool awaiting = false;
+    Range* pending = nullptr;
+    uint8_t pendingFunction = 0;
+    uint16_t pendingStart = 0;
+    uint16_t pendingCount = 0;
+    uint16_t expected = 0;
+    uint32_t sentAt = 0;
+    uint8_t rx[BUS_STATS_MAX_FRAME];
+    uint16_t rxLength = 0;
+
+    bool cycleActive = false;
+    uint32_t cycleStart = 0;
+    uint32_t cycleMaxMs = 0;
+    uint32_t lastResponseAt = 0;
+    size_t queueDepthMax = 0;
+
+    static uint16_t crc16(const uint8_t* data, uint16_t length) {
+        uint16_t crc = 0xFFFF;
+        for (uint16_t i = 0; i < length; i++) {
+            crc ^= data[i];
+            for (uint8_t bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+            }
+        }
+        return crc;
+    }
+
+    const Range* find(uint16_t start) const {
+        for (uint8_t i = 0; i < rangeCount; i++) {
+            if (ranges[i].start == start) {
+                return &ranges[i];
+            }
+        }
+        return nullptr;
+    }
+
+    Range* findOrAdd(uint16_t start) {
+        Range* range = const_cast<Range*>(find(start));
+        if (range == nullptr && rangeCount < BUS_STATS_RANGES) {
+            range = &ranges[rangeCount++];
+            *range = Range{start, 0, 0, 0, 0, LatencyHistogram()};
+        }
+        return range;
+    }
+
+    void onRequest(const std::vector<uint8_t>& bytes, uint32_t now) {
+        if (bytes.size() < 8) {
+            return;
+        }
+        if (awaiting) {
+            timeouts++;
+            if (pending != nullptr) {
+                pending->timeouts++;
+            }
+        }
+        if (!cycleActive) {
+            cycleActive = true;
+            cycleStart = now;
+            lastResponseAt = 0;
+        }
+
+        uint8_t function = bytes[1];
+        uint16_t start = (bytes[2] << 8) | bytes[3];
+        uint16_t count = (bytes[4] << 8) | bytes[5];
+        pending = nullptr;
+        pendingFunction = function;
+        pendingStart = start;
+        pendingCount = count;
+        switch (function) {
+            case 0x03:
+            case 0x04:
+                // Read: address, function, byte count, data, CRC
+                expected = 5 + count * 2;
+                pending = findOrAdd(start);
+                break;
+            case 0x06:
+            case 0x10:
+                // Write: echo of address, function, register and value/count, CRC
+                expected = 8;
+                break;
+            default:
+                awaiting = false;
+                return;
+        }
+        if (pending != nullptr) {
+            pending->requests++;
+        }
+        requests++;
+        awaiting = true;
+        sentAt = now;
+        rxLength = 0;
+    }
+
+    void onResponse(const std::vector<uint8_t>& bytes, uint32_t now) {
+        if (!awaiting) {
+            return;
+        }
+        for (uint8_t byte : bytes) {
+            if (rxLength < BUS_STATS_MAX_FRAME) {
+                rx[rxLength++] = byte;
+            }
+        }
+        if (rxLength >= 2 && (rx[1] & 0x80)) {
+            expected = 5;
+        }
+        if (rxLength < expected) {
+            return;
+        }
+
+        awaiting = false;
+        lastResponseAt = now;
+        uint16_t crc = rx[expected - 2] | (rx[expected - 1] << 8);
+        if (crc != crc16(rx, expected - 2)) {
+            crcErrors++;
+            if (pending != nullptr) {
+                pending->crcErrors++;
+            }
+            return;
+        }
+        if (rx[1] & 0x80) {
+            exceptions++;
+            lastException = rx[2];
+            if (pending != nullptr) {
+                pending->exceptions++;
+            }
+        } else if (onRead && (pendingFunction == 0x03 || pendingFunction == 0x04) && rx[2] == pendingCount * 2) {
+            onRead(pendingFunction, pendingStart, pendingCount, rx + 3, now);
+        }
+        latency.add(now - sentAt);
+        recent.add(now - sentAt);
+        if (pending != nullptr) {
+            pending->latency.add(now - sentAt);
+        }
+    }
+};
+
+// ============================================================================
+// Link Profile
+// ============================================================================
+
+class ModbusLinkProfile {
+public:
+    enum State : uint8_t {
+        LINK_BASE,      // Base rate, fast link off
+        LINK_CHECKING,  // Fast rate since boot, first requests are being checked
+        LINK_FAST,      // Fast rate in use
+        LINK_FALLBACK   // Fast rate failed, back at the base rate until reboot
+    };
+
+    State state = LINK_BASE;
+    uint32_t baudRate = 0;
+    uint16_t sendWaitMs = 0;
+
+    // fastBaud 0 keeps the base rate; sendWaitMs is the configured
+    // send_wait_time of the modbus component
+    void configure(uint32_t fastBaud, uint16_t sendWait) {
+        this->fastBaud = fastBaud;
+        this->baseSendWaitMs = sendWait;
+        this->sendWaitMs = sendWait;
+    }
+
+    // Called from an interval
+    void service(esphome::uart::UARTComponent* uart, esphome::modbus::Modbus* modbus, ModbusBusStats& stats,
+                 uint32_t now) {
+        if (baudRate == 0) {
+            // First call, right after boot: the uart is configured with the
+            // base rate and the link starts at the rate the unit was set to
+            baudRate = uart->get_baud_rate();
+            baseBaud = baudRate;
+            if (fastBaud != 0 && fastBaud != baseBaud) {
+                setBaud(uart, fastBaud);
+                startWindow(stats, now);
+                state = LINK_CHECKING;
+            }
+        }
+        switch (state) {
+            case LINK_BASE:
+                break;
+            case LINK_CHECKING:
+            case LINK_FAST: {
+                uint32_t requests = stats.requests - windowRequests;
+                if (requests < LINK_CHECK_REQUESTS && now - windowStart < LINK_CHECK_TIMEOUT_MS) {
+                    break;
+                }
+                uint32_t errors = stats.crcErrors + stats.timeouts - windowErrors;
+                if (requests == 0 || errors * 100 > requests * LINK_MAX_ERROR_PERCENT) {
+                    setBaud(uart, baseBaud);
+                    setSendWait(modbus, baseSendWaitMs);
+                    state = LINK_FALLBACK;
+                    break;
+                }
+                if (stats.recent.max != 0) {
+                    uint32_t wait = stats.recent.max + LINK_SEND_WAIT_MARGIN_MS;
+                    wait = wait < LINK_MIN_SEND_WAIT_MS ? LINK_MIN_SEND_WAIT_MS : wait;
+                    wait = wait > baseSendWaitMs ? baseSendWaitMs : wait;
+                    setSendWait(modbus, wait);
+                }
+                startWindow(stats, now);
+                state = LINK_FAST;
+                break;
+            }
+            case LINK_FALLBACK:
+                break;
+        }
+    }
+
+    const char* stateName() const {
+        static const char* const NAMES[] = {"base", "checking", "fast", "fallback"};
+        return NAMES[state];
+    }
+
+    // "19200 baud, fast, wait 120ms"
+    std::string summary() const {
+        char text[48];
+        snprintf(text, sizeof(text), "%u baud, %s, wait %ums", (unsigned) baudRate, stateName(),
+                 (unsigned) sendWaitMs);
+        return text;
+    }
+
+private:
+    uint32_t fastBaud = 0;
+    uint32_t baseBaud = 0;
+    uint16_t baseSendWaitMs = 250;
+
+    uint32_t windowStart = 0;
+    uint32_t windowRequests = 0;
+    uint32_t windowErrors = 0;
+
+    void setBaud(esphome::uart::UARTComponent* uart, uint32_t baud) {
+        uart->set_baud_rate(baud);
+        uart->load_settings(false);
+        baudRate = baud;
+    }
+
+    void setSendWait(esphome::modbus::Modbus* modbus, uint16_t wait) {
+        modbus->set_send_wait_time(wait);
+        sendWaitMs = wait;
+    }
+
+    void startWindow(ModbusBusStats& stats, uint32_t now) {
+        windowStart = now;
+        windowRequests = stats.requests;
+        windowErrors = stats.crcErrors + stats.timeouts;
+        stats.recent.reset();
+    }
+};
+
+ModbusBusStats bus_stats;
+ModbusLinkProfile link_profile;
@@ -0,0 +1,215 @@
+/*
+ * Heat Pump Derived Metrics
+ * COP, daily energy and compressor starts, computed when their input
+ * sensors get a new value instead of on separate timers.
+ *
+ * The energy counters (electricity consumption and power output, both
+ * cumulative kWh) are sampled at most once per METRICS_SAMPLE_MS into a ring
+ * for the last hour, and once per hour into a ring for the last day. As the
+ * counters are only published when they change (or on the heartbeat), the
+ * samples are not evenly spaced; a window starts at the oldest sample that
+ * is at most its length older than the newest one. The COP of a window is
+ * the produced energy divided by the consumed energy between these two
+ * samples. Both counters are read in one request, so a sample is taken
+ * when the power output is published, with the consumption of the same
+ * response. A counter that goes back (reset, replaced controller) clears the
+ * rings.
+ *
+ * The seasonal SCOP is calculated from a baseline that is kept in a
+ * restored global and can be reset with a button.
+ *
+ * Compressor starts are the rising edges of the compressor frequency and
+ * are counted over a rolling hour.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+// Interval of the samples in the hour ring
+#ifndef METRICS_SAMPLE_MS
+#define METRICS_SAMPLE_MS 60000
+#endif
+
+// Samples per ring: enough for one hour of METRICS_SAMPLE_MS samples and
+// one day of hourly samples
+#define METRICS_HOUR_SAMPLES 61
+#define METRICS_DAY_SAMPLES 25
+
+// Compressor starts remembered for the rolling hour
+#ifndef METRICS_MAX_STARTS
+#define METRICS_MAX_STARTS 64
+#endif
+
+#define METRICS_HOUR_MS 3600000UL
+#define METRICS_DAY_MS (24 * METRICS_HOUR_MS)
+
+// ============================================================================
+// Derived Metrics
+// ============================================================================
+
+// Counter values the seasonal SCOP starts from, kept in a restored global
+struct MetricsBaseline {
+    float consumed;
+    float produced;
+};
+
+class DerivedMetrics {
+public:
+    // New value of the energy counters, both from the same poll. Returns
+    // true when a sample was taken and the COP values changed.
+    bool onEnergy(float consumedKwh, float producedKwh, uint32_t now) {
+        consumed = consumedKwh;
+        produced = producedKwh;
+        return sample(now);
+    }
+
+    // New compressor frequency
+    void onCompressor(float frequency, uint32_t now) {
+        bool running = frequency > 0;
+        if (running && !compressorRunning && compressorKnown) {
+            starts[startIndex] = now;
+            startIndex = (startIndex + 1) % METRICS_MAX_STARTS;
+            if (startCount < METRICS_MAX_STARTS) {
+                startCount++;
+            }
+        }
+        compressorRunning = running;
+        compressorKnown = true;
+    }
+
+    uint32_t startsLastHour(uint32_t now) const {
+        uint32_t count = 0;
+        for (uint8_t i = 0; i < startCount; i++) {
+            if (now - starts[i] < METRICS_HOUR_MS) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // NAN until a window has samples with consumed energy in between
+    float copHour() const {
+        return hour.cop();
+    }
+
+    float scopDay() const {
+        return day.cop();
+    }
+
+    float consumedDay() const {
+        return day.consumed();
+    }
+
+    float producedDay() const {
+        return day.produced();
+    }
+
+    float lifetimeCop() const {
+        return ratio(produced, consumed);
+    }
+
+    float seasonalScop(const MetricsBaseline& baseline) const {
+        return ratio(produced - baseline.produced, consumed - baseline.consumed);
+    }
+
+    MetricsBaseline baseline() const {
+        return MetricsBaseline{consumed, produced};
+    }
+
+private:
+    struct Sample {
+        uint32_t at;
+        float consumed;
+        float produced;
+    };
+
+    template<uint8_t N, uint32_t SPAN>
+    struct Window {
+        Sample samples[N];
+        uint8_t newest = 0;
+        uint8_t count = 0;
+
+        const Sample& last() const {
+            return samples[newest];
+        }
+
+        // Oldest sample at most SPAN before the newest one
+        const Sample& oldest() const {
+            for (uint8_t age = count - 1; age > 0; age--) {
+                const Sample& sample = samples[(newest + N - age) % N];
+                if (last().at - sample.at <= SPAN) {
+                    return sample;
+                }
+            }
+            return last();
+        }
+
+        void add(const Sample& sample) {
+            newest = count == 0 ? 0 : (newest + 1) % N;
+            samples[newest] = sample;
+            if (count < N) {
+                count++;
+            }
+        }
+
+        void clear() {
+            count = 0;
+        }
+
+        float consumed() const {
+            return count == 0 ? NAN : last().consumed - oldest().consumed;
+        }
+
+        float produced() const {
+            return count == 0 ? NAN : last().produced - oldest().produced;
+        }
+
+        float cop() const {
+            return count == 0 ? NAN : ratio(produced(), consumed());
+        }
+    };
+
+    float consumed = NAN;
+    float produced = NAN;
+    Window<METRICS_HOUR_SAMPLES, METRICS_HOUR_MS> hour;
+    Window<METRICS_DAY_SAMPLES, METRICS_DAY_MS> day;
+
+    bool compressorRunning = false;
+    bool compressorKnown = false;
+    uint32_t starts[METRICS_MAX_STARTS] = {};
+    uint8_t startIndex = 0;
+    uint8_t startCount = 0;
+
+    static float ratio(float output, float input) {
+        return input > 0 && output >= 0 ? output / input : NAN;
+    }
+
+    bool sample(uint32_t now) {
+        if (std::isnan(consumed) || std::isnan(produced)) {
+            return false;
+        }
+        if (hour.count > 0) {
+            const Sample& last = hour.last();
+            if (consumed < last.consumed || produced < last.produced) {
+                hour.clear();
+                day.clear();
+            } else if (now - last.at < METRICS_SAMPLE_MS) {
+                return false;
+            }
+        }
+        Sample sample{now, consumed, produced};
+        hour.add(sample);
+        if (day.count == 0 || now - day.last().at >= METRICS_HOUR_MS) {
+            day.add(sample);
+        }
+        return true;
+    }
+};
+
+DerivedMetrics metrics;
@@ -0,0 +1,153 @@
+/*
+ * Heat Pump MQTT Batch
+ * Publishes the changed sensor values of a poll cycle as one MQTT message,
+ * instead of one topic per sensor and update. Used by the models with
+ * `mqtt_batch` enabled (see DEVELOPMENT.md), where the generator turns off
+ * the state topics of these sensors.
+ *
+ * Each batched sensor is a channel. The values are added by a filter behind
+ * the publish filter, so only the values that would have been published
+ * end up in a batch. Per channel the last value and the millis() it was
+ * sampled at are kept until the batch is sent. A batch goes out once the
+ * Modbus poll cycle ended (the controller queue ran empty, see
+ * heatpump_bus_stats.h):
+ *
+ *   {"seq":42,"ms":123456,"values":{"t4":[12.5,123380],...}}
+ *
+ * seq counts the messages since boot, so a consumer can tell when one got
+ * lost; ms is millis() when it was sent and every value carries the
+ * millis() of its sample, so a value was sampled ms - at milliseconds before
+ * the message was sent. A batch longer than MQTT_BATCH_MAX_BYTES is split into
+ * several messages. While MQTT is not connected the values are kept and the
+ * latest value of each sensor is sent after the first cycle once it is.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "esphome/components/mqtt/mqtt_client.h"
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+// Longest message; the values of a cycle are split over several messages
+// above this
+#ifndef MQTT_BATCH_MAX_BYTES
+#define MQTT_BATCH_MAX_BYTES 2048
+#endif
+
+// ============================================================================
+// MQTT Batch
+// ============================================================================
+
+class MqttBatch {
+public:
+    uint32_t seq = 0;     // Messages sent since boot
+    uint32_t values = 0;  // Values sent since boot
+
+    // Channel names (the entity ids without the device name), called at boot
+    void configure(const char* const* names, uint16_t count, const char* topic) {
+        this->names = names;
+        this->topic = topic;
+        samples.assign(count, Sample());
+    }
+
+    void add(uint16_t channel, float value, uint32_t now) {
+        if (channel >= samples.size()) {
+            return;
+        }
+        Sample& sample = samples[channel];
+        if (!sample.dirty) {
+            pending++;
+        }
+        sample = Sample{value, now, true};
+    }
+
+    // Send the changed values once a poll cycle ended, called from an
+    // interval with the completed cycles of the bus statistics
+    void service(uint32_t cycles, uint32_t now) {
+        if (cycles == seenCycles) {
+            return;
+        }
+        seenCycles = cycles;
+        auto* client = esphome::mqtt::global_mqtt_client;
+        if (pending == 0 || client == nullptr || !client->is_connected()) {
+            return;
+        }
+
+        std::string payload;
+        payload.reserve(MQTT_BATCH_MAX_BYTES + 64);
+        bool empty = begin(payload, now);
+        for (uint16_t channel = 0; channel < samples.size(); channel++) {
+            Sample& sample = samples[channel];
+            if (!sample.dirty) {
+                continue;
+            }
+            std::string item = format(channel);
+            // The comma and the closing "}}"
+            if (!empty && payload.size() + item.size() + 3 > MQTT_BATCH_MAX_BYTES) {
+                send(client, payload);
+                empty = begin(payload, now);
+            }
+            if (!empty) {
+                payload += ',';
+            }
+            payload += item;
+            empty = false;
+            sample.dirty = false;
+            values++;
+        }
+        send(client, payload);
+        pending = 0;
+    }
+
+private:
+    struct Sample {
+        float value = NAN;
+        uint32_t at = 0;
+        bool dirty = false;
+    };
+
+    const char* const* names = nullptr;
+    const char* topic = "";
+    std::vector<Sample> samples;
+    uint16_t pending = 0;
+    uint32_t seenCycles = 0;
+
+    // Start a message, true because it has no values yet
+    bool begin(std::string& payload, uint32_t now) {
+        char head[64];
+        snprintf(head, sizeof(head), "{\"seq\":%u,\"ms\":%u,\"values\":{", (unsigned) seq, (unsigned) now);
+        payload = head;
+        return true;
+    }
+
+    // "t4":[12.5,123380], sized for the name so it is never cut off. %.7g
+    // keeps all the digits a float has, so energy counters are not rounded.
+    std::string format(uint16_t channel) const {
+        const Sample& sample = samples[channel];
+        // Quotes, brackets and separators, a %.7g float and a uint32_t
+        std::string item(strlen(names[channel]) + 32, '\0');
+        int length = std::isfinite(sample.value)
+                         ? snprintf(&item[0], item.size(), "\"%s\":[%.7g,%u]", names[channel], sample.value,
+                                    (unsigned) sample.at)
+                         : snprintf(&item[0], item.size(), "\"%s\":[null,%u]", names[channel], (unsigned) sample.at);
+        item.resize(length > 0 ? length : 0);
+        return item;
+    }
+
+    void send(esphome::mqtt::MQTTClientComponent* client, std::string& payload) {
+        payload += "}}";
+        client->publish(topic, payload, 0, false);
+        seq++;
+    }
+};
+
+MqttBatch mqtt_batch;
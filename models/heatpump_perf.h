@@ -0,0 +1,209 @@
+/*
+ * Heat Pump Performance
+ * How the controller itself is holding up, for diagnostic sensors that can
+ * be compared between firmware versions: the time spent in the Modbus
+ * decode path and in the XYE receive path, how late the main loop runs the
+ * fast interval and the XYE command queue depth (the Modbus queue depth is in
+ * the bus statistics). Free heap, the largest free block and the loop time
+ * come from the ESPHome debug component.
+ *
+ * A PerfSection keeps the number of calls, the total and the longest time of
+ * a code path in microseconds, since the sensor last took them, and the
+ * share of the CPU time it took (its load). Measuring is
+ * two micros() calls per pass, so it stays on all the time.
+ *
+ * Modbus decode time: the read commands on the controller queue get their
+ * on_data_func wrapped (like the register cache does for its writes), which
+ * times the parsing and publishing of every entity in that range. Commands
+ * that answer before the next wrapDecoders() pass are not timed.
+ *
+ * Loop lag: the fast interval calls tick() with its interval; the time
+ * between two calls beyond that interval is the time the main loop was busy
+ * elsewhere when the interval was due. A slowly degrading device shows up
+ * here before the bus timing suffers.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "esphome/core/hal.h"
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+// Read commands on the queue that can be wrapped at once
+#define PERF_WRAPPED_COMMANDS 32
+
+// ============================================================================
+// Performance
+// ============================================================================
+
+class PerfSection {
+public:
+    uint32_t calls = 0;  // Passes since boot
+
+    void add(uint32_t us) {
+        calls++;
+        averageCalls++;
+        averageTotal += us;
+        loadTotal += us;
+        maxCalls++;
+        if (us > max) {
+            max = us;
+        }
+    }
+
+    // Mean and longest pass (µs) since the last call, NAN without passes,
+    // for sensors that report a window
+    float takeAverage() {
+        float value = averageCalls != 0 ? (float) averageTotal / averageCalls : NAN;
+        averageCalls = 0;
+        averageTotal = 0;
+        return value;
+    }
+
+    float takeMax() {
+        float value = maxCalls != 0 ? (float) max : NAN;
+        maxCalls = 0;
+        max = 0;
+        return value;
+    }
+
+    // Share of the time since the last call spent in this path (%), NAN on
+    // the first call
+    float takeLoad() {
+        uint32_t now = esphome::micros();
+        float value = loadStarted && now != loadSince ? 100.0f * loadTotal / (uint32_t) (now - loadSince) : NAN;
+        loadStarted = true;
+        loadSince = now;
+        loadTotal = 0;
+        return value;
+    }
+
+private:
+    uint32_t averageCalls = 0;
+    uint64_t averageTotal = 0;
+    uint32_t maxCalls = 0;
+    uint32_t max = 0;
+    uint64_t loadTotal = 0;
+    uint32_t loadSince = 0;
+    bool loadStarted = false;
+};
+
+// Times the rest of the scope
+class PerfTimer {
+public:
+    explicit PerfTimer(PerfSection& section) : section(section), startedAt(esphome::micros()) {}
+
+    ~PerfTimer() {
+        section.add(esphome::micros() - startedAt);
+    }
+
+private:
+    PerfSection& section;
+    uint32_t startedAt;
+};
+
+class PerfStats {
+public:
+    PerfSection loopLag;  // Fast interval run later than due
+    PerfSection modbus;   // Decoding a read response
+    PerfSection xye;      // XYE receive, decode and publish
+
+    // Called first in the fast interval, with its interval
+    void tick(uint32_t intervalMs) {
+        uint32_t now = esphome::micros();
+        if (ticked) {
+            uint32_t gap = now - lastTick;
+            loopLag.add(gap > intervalMs * 1000 ? gap - intervalMs * 1000 : 0);
+        }
+        ticked = true;
+        lastTick = now;
+    }
+
+    // Command queue length of a bus without statistics of its own (XYE),
+    // called from its fast interval
+    void queued(size_t length) {
+        if (length > queueMax) {
+            queueMax = length;
+        }
+    }
+
+    // Longest queue since the last call
+    size_t takeQueueMax() {
+        size_t value = queueMax;
+        queueMax = 0;
+        return value;
+    }
+
+    // Wrap the read commands queued since the last call, called from an
+    // interval
+    template <typename Controller>
+    void wrapDecoders(Controller* controller) {
+        struct Access : Controller {
+            static auto& queue(Controller* controller) {
+                return controller->*(&Access::command_queue_);
+            }
+        };
+
+        const void* kept[PERF_WRAPPED_COMMANDS];
+        uint8_t keptCount = 0;
+        for (auto& command : Access::queue(controller)) {
+            uint8_t function = static_cast<uint8_t>(command->function_code);
+            if ((function != 3 && function != 4) || keptCount == PERF_WRAPPED_COMMANDS) {
+                continue;
+            }
+            const void* key = command.get();
+            kept[keptCount++] = key;
+            if (isWrapped(key)) {
+                continue;
+            }
+            auto forward = command->on_data_func;
+            command->on_data_func = [this, forward, key](auto type, uint16_t start, const std::vector<uint8_t>& data) {
+                PerfTimer timer(modbus);
+                forget(key);
+                if (forward) {
+                    forward(type, start, data);
+                }
+            };
+        }
+        memcpy(wrapped, kept, keptCount * sizeof(kept[0]));
+        wrappedCount = keptCount;
+    }
+
+private:
+    bool ticked = false;
+    uint32_t lastTick = 0;
+    size_t queueMax = 0;
+
+    // Queued commands that are wrapped already. A command leaves the list
+    // when it answered, so a new command at the same address is wrapped again.
+    const void* wrapped[PERF_WRAPPED_COMMANDS];
+    uint8_t wrappedCount = 0;
+
+    bool isWrapped(const void* key) const {
+        for (uint8_t i = 0; i < wrappedCount; i++) {
+            if (wrapped[i] == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void forget(const void* key) {
+        for (uint8_t i = 0; i < wrappedCount; i++) {
+            if (wrapped[i] == key) {
+                wrapped[i] = wrapped[--wrappedCount];
+                return;
+            }
+        }
+    }
+};
+
+PerfStats perf_stats;
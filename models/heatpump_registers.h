@@ -0,0 +1,564 @@
+/*
+ * Heat Pump Register Cache
+ * Shadow copy of the holding registers that pack several settings into one
+ * 16-bit word (bit flags, high/low bytes, 4-bit fields).
+ *
+ * The raw register entities feed every poll result into the cache with
+ * update(). Bitfield entities read their field from the cache and change it
+ * with setField()/setFlag(). A change only updates the shadow value and
+ * marks the changed bits; flush() writes the register once the merge window
+ * has passed, so changes to several fields of the same register (e.g. an
+ * automation turning two switches on) become one write of the combined
+ * value. Until the heat pump confirmed the write, poll results do not
+ * overwrite the changed bits, so a poll that was queued before the write
+ * cannot flip them back.
+ *
+ * A register is only written after it was read at least once, so bits that
+ * were never read are not overwritten with 0.
+ *
+ * Switches and binary sensors that show a single bit are bound to the cache
+ * at boot (`register_flag` in the model files, the generator writes the
+ * bind() calls). One loop over the bound bits publishes the ones that
+ * changed, instead of a lambda per entity that runs every loop iteration.
+ *
+ * The write lane moves every queued holding register write (from the cache
+ * or from a plain number/select) ahead of the reads on the controller queue,
+ * drops writes that a newer write to the same register replaced and combines
+ * writes to adjacent registers into one multi-register (0x10) write.
+ *
+ * The value to text tables of the selects and text sensors (`enums` in the
+ * model files) are generated as sorted constexpr arrays, the lambdas look
+ * the texts up with enumLookup()/enumText() instead of if/else chains and
+ * map filters.
+ *
+ * The state snapshot keeps the last state of the slow and boot class
+ * entities (installer settings, product code, limits) in a restored global,
+ * so they are available right after a reboot or OTA. The model generator
+ * writes the code that fills and restores it. While the restored states are
+ * used, the slow and boot ranges are read a few cycles later, so the first
+ * cycles only read the live registers.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "esphome/core/hal.h"
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#include "esphome/components/modbus_controller/modbus_controller.h"
+#include "esphome/components/switch/switch.h"
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+// Number of registers that can be cached (no heap is used)
+#ifndef REGISTER_CACHE_SIZE
+#define REGISTER_CACHE_SIZE 16
+#endif
+
+// Changes to one register within this window are written together
+#ifndef REGISTER_CACHE_MERGE_MS
+#define REGISTER_CACHE_MERGE_MS 100
+#endif
+
+// Give up waiting for a write confirmation after this time; the next poll
+// result is taken over as is
+#ifndef REGISTER_CACHE_ACK_TIMEOUT_MS
+#define REGISTER_CACHE_ACK_TIMEOUT_MS 5000
+#endif
+
+// Number of switches and binary sensors that can be bound to register bits
+#ifndef REGISTER_FLAGS_SIZE
+#define REGISTER_FLAGS_SIZE 64
+#endif
+
+// Number of queued registers the write lane handles per pass, further writes
+// stay where they are until the next pass
+#ifndef WRITE_LANE_REGISTERS
+#define WRITE_LANE_REGISTERS 32
+#endif
+
+// ============================================================================
+// Register Cache
+// ============================================================================
+
+class RegisterCache {
+public:
+    uint32_t writes = 0;   // Register writes queued
+    uint32_t merged = 0;   // Field changes combined into an already pending write
+    uint32_t dropped = 0;  // Changes ignored because the cache was full
+
+    // Poll result of a register. Bits with a change that is not written or
+    // not confirmed yet keep their local value.
+    void update(uint16_t address, uint16_t value) {
+        Entry* entry = findOrAdd(address);
+        if (entry == nullptr) {
+            return;
+        }
+        uint16_t keep = entry->dirty | entry->inflight;
+        entry->value = (value & ~keep) | (entry->value & keep);
+        entry->valid = true;
+    }
+
+    uint16_t get(uint16_t address) const {
+        const Entry* entry = find(address);
+        return entry != nullptr ? entry->value : 0;
+    }
+
+    uint16_t field(uint16_t address, uint16_t mask, uint8_t shift = 0) const {
+        return (get(address) & mask) >> shift;
+    }
+
+    bool flag(uint16_t address, uint16_t mask) const {
+        return (get(address) & mask) == mask;
+    }
+
+    // True once the register was read
+    bool known(uint16_t address) const {
+        const Entry* entry = find(address);
+        return entry != nullptr && entry->valid;
+    }
+
+    // Set the bits in mask to value << shift and schedule the write
+    void setField(uint16_t address, uint16_t mask, uint8_t shift, uint16_t value) {
+        Entry* entry = findOrAdd(address);
+        if (entry == nullptr) {
+            dropped++;
+            return;
+        }
+        uint16_t newValue = (entry->value & ~mask) | ((value << shift) & mask);
+        uint16_t changed = newValue ^ entry->value;
+        if (changed == 0) {
+            return;
+        }
+        if (entry->dirty != 0) {
+            merged++;
+        } else {
+            entry->changedAt = esphome::millis();
+        }
+        entry->value = newValue;
+        entry->dirty |= changed;
+    }
+
+    void setFlag(uint16_t address, uint16_t mask, bool on) {
+        setField(address, mask, 0, on ? mask : 0);
+    }
+
+    // Write the registers whose merge window has passed, called from an
+    // interval
+    void flush(esphome::modbus_controller::ModbusController* controller, uint32_t now) {
+        for (uint8_t i = 0; i < count; i++) {
+            Entry& entry = entries[i];
+            if (entry.inflight != 0 && (now - entry.sentAt) > REGISTER_CACHE_ACK_TIMEOUT_MS) {
+                entry.inflight = 0;
+            }
+            if (entry.dirty == 0 || !entry.valid || (now - entry.changedAt) < REGISTER_CACHE_MERGE_MS) {
+                continue;
+            }
+
+            auto command = esphome::modbus_controller::ModbusCommandItem::create_write_single_command(
+                controller, entry.address, entry.value);
+            auto forward = command.on_data_func;
+            uint16_t address = entry.address;
+            uint16_t sent = entry.dirty;
+            command.on_data_func = [this, forward, address, sent](esphome::modbus_controller::ModbusRegisterType type,
+                                                                  uint16_t start, const std::vector<uint8_t>& data) {
+                if (forward) {
+                    forward(type, start, data);
+                }
+                acknowledge(address, sent);
+            };
+            controller->queue_command(command);
+
+            entry.inflight |= entry.dirty;
+            entry.dirty = 0;
+            entry.sentAt = now;
+            writes++;
+        }
+    }
+
+private:
+    struct Entry {
+        uint16_t address;
+        uint16_t value;
+        uint16_t dirty;      // Bits changed locally, not written yet
+        uint16_t inflight;   // Bits written, not confirmed yet
+        bool valid;          // Read from the heat pump at least once
+        uint32_t changedAt;  // millis() of the first change since the last write
+        uint32_t sentAt;     // millis() of the last write
+    };
+
+    Entry entries[REGISTER_CACHE_SIZE] = {};
+    uint8_t count = 0;
+
+    const Entry* find(uint16_t address) const {
+        for (uint8_t i = 0; i < count; i++) {
+            if (entries[i].address == address) {
+                return &entries[i];
+            }
+        }
+        return nullptr;
+    }
+
+    Entry* find(uint16_t address) {
+        return const_cast<Entry*>(static_cast<const RegisterCache*>(this)->find(address));
+    }
+
+    Entry* findOrAdd(uint16_t address) {
+        Entry* entry = find(address);
+        if (entry == nullptr && count < REGISTER_CACHE_SIZE) {
+            entry = &entries[count++];
+            *entry = Entry{address, 0, 0, 0, false, 0, 0};
+        }
+        return entry;
+    }
+
+    // Only the bits of this write: a later write of the same register may
+    // still be on its way
+    void acknowledge(uint16_t address, uint16_t sent) {
+        Entry* entry = find(address);
+        if (entry != nullptr) {
+            entry->inflight &= ~sent;
+        }
+    }
+};
+
+// ============================================================================
+// Register Flags
+// ============================================================================
+
+class RegisterFlags {
+public:
+    explicit RegisterFlags(RegisterCache& cache) : cache(cache) {}
+
+    // A switch shows the bit and sets it when it is turned on or off
+    void bind(esphome::switch_::Switch* entity, uint16_t address, uint16_t mask) {
+        Flag* flag = add(address, mask);
+        if (flag == nullptr) {
+            return;
+        }
+        flag->toggle = entity;
+        entity->add_on_state_callback([this, flag](bool state) {
+            flag->published = state;
+            this->cache.setFlag(flag->address, flag->mask, state);
+        });
+    }
+
+    void bind(esphome::binary_sensor::BinarySensor* entity, uint16_t address, uint16_t mask) {
+        Flag* flag = add(address, mask);
+        if (flag != nullptr) {
+            flag->sensor = entity;
+        }
+    }
+
+    // Publish the bits that changed since the last call, called from an
+    // interval. Bits of registers that were not read yet stay unknown.
+    void service() {
+        for (uint8_t i = 0; i < count; i++) {
+            Flag& flag = flags[i];
+            if (!cache.known(flag.address)) {
+                continue;
+            }
+            int8_t on = cache.flag(flag.address, flag.mask);
+            if (on == flag.published) {
+                continue;
+            }
+            flag.published = on;
+            if (flag.toggle != nullptr) {
+                flag.toggle->publish_state(on);
+            } else {
+                flag.sensor->publish_state(on);
+            }
+        }
+    }
+
+private:
+    struct Flag {
+        uint16_t address;
+        uint16_t mask;
+        int8_t published;  // Last state published, -1 before the first
+        esphome::switch_::Switch* toggle;
+        esphome::binary_sensor::BinarySensor* sensor;
+    };
+
+    RegisterCache& cache;
+    Flag flags[REGISTER_FLAGS_SIZE] = {};
+    uint8_t count = 0;
+
+    Flag* add(uint16_t address, uint16_t mask) {
+        if (count >= REGISTER_FLAGS_SIZE) {
+            return nullptr;
+        }
+        flags[count] = Flag{address, mask, -1, nullptr, nullptr};
+        return &flags[count++];
+    }
+};
+
+// ============================================================================
+// Write Lane
+// ============================================================================
+
+// The command queue of the controller is protected; a member pointer formed
+// through a derived class gives access to it without changing the controller
+struct ModbusQueueAccess : esphome::modbus_controller::ModbusController {
+    static auto& queue(esphome::modbus_controller::ModbusController* controller) {
+        return controller->*(&ModbusQueueAccess::command_queue_);
+    }
+};
+
+class ModbusWriteLane {
+public:
+    uint32_t promoted = 0;    // Writes moved ahead of queued reads
+    uint32_t superseded = 0;  // Register writes dropped for a newer write to the same register
+    uint32_t merged = 0;      // Writes saved by combining adjacent registers
+
+    // Reorder the writes on the controller queue, called from an interval.
+    // With writeMultiple false, adjacent registers are still written one by one.
+    void service(esphome::modbus_controller::ModbusController* controller, bool writeMultiple = true) {
+        using namespace esphome::modbus_controller;
+        auto& queue = ModbusQueueAccess::queue(controller);
+        if (queue.size() < 2) {
+            return;
+        }
+
+        // The first command may already be on the bus and stays in place
+        auto behindFront = std::next(queue.begin());
+        if (!needsReorder(behindFront, queue.end(), writeMultiple)) {
+            return;
+        }
+
+        // Take the writes out of the queue, the newest value of each register wins
+        std::vector<std::unique_ptr<ModbusCommandItem>> taken;
+        count = 0;
+        bool afterRead = false;
+        for (auto it = behindFront; it != queue.end();) {
+            ModbusCommandItem& command = **it;
+            if (!isWrite(command) || count + command.register_count > WRITE_LANE_REGISTERS || taken.size() >= MAX_SOURCES) {
+                afterRead |= !isWrite(command);
+                ++it;
+                continue;
+            }
+            if (afterRead) {
+                promoted++;
+            }
+            for (uint16_t i = 0; i < command.register_count; i++) {
+                uint16_t value = (command.payload[i * 2] << 8) | command.payload[i * 2 + 1];
+                set(command.register_address + i, value, taken.size());
+            }
+            taken.push_back(std::move(*it));
+            it = queue.erase(it);
+        }
+
+        // One write per run of adjacent registers, queued right behind the
+        // front. The taken writes may have included the command behind the
+        // front, so they are spliced in at the position as it is now.
+        std::list<std::unique_ptr<ModbusCommandItem>> lane;
+        for (uint8_t start = 0; start < count;) {
+            uint8_t end = start + 1;
+            while (writeMultiple && end < count && pending[end].address == pending[end - 1].address + 1) {
+                end++;
+            }
+
+            uint32_t sources = 0;
+            std::vector<uint16_t> values;
+            for (uint8_t i = start; i < end; i++) {
+                sources |= pending[i].sources;
+                values.push_back(pending[i].value);
+            }
+            ModbusCommandItem command = end - start == 1
+                ? ModbusCommandItem::create_write_single_command(controller, pending[start].address, values[0])
+                : ModbusCommandItem::create_write_multiple_command(controller, pending[start].address, end - start, values);
+
+            // Pass the response to the handlers of every write that went into this one
+            auto handlers = std::make_shared<std::vector<decltype(command.on_data_func)>>();
+            for (size_t i = 0; i < taken.size(); i++) {
+                if ((sources & (uint32_t(1) << i)) && taken[i]->on_data_func) {
+                    handlers->push_back(taken[i]->on_data_func);
+                }
+            }
+            command.on_data_func = [handlers](ModbusRegisterType type, uint16_t address, const std::vector<uint8_t>& data) {
+                for (auto& handler : *handlers) {
+                    handler(type, address, data);
+                }
+            };
+
+            lane.push_back(std::unique_ptr<ModbusCommandItem>(new ModbusCommandItem(std::move(command))));
+            start = end;
+        }
+        if (taken.size() > lane.size()) {
+            merged += taken.size() - lane.size();
+        }
+        queue.splice(std::next(queue.begin()), lane);
+    }
+
+private:
+    struct Register {
+        uint16_t address;
+        uint16_t value;
+        uint32_t sources;  // Bit per taken command that wrote this register
+    };
+
+    static constexpr size_t MAX_SOURCES = 32;  // Bits in Register::sources
+
+    Register pending[WRITE_LANE_REGISTERS];
+    uint8_t count = 0;
+
+    static bool isWrite(const esphome::modbus_controller::ModbusCommandItem& command) {
+        using esphome::modbus_controller::ModbusFunctionCode;
+        return command.register_type == esphome::modbus_controller::ModbusRegisterType::HOLDING &&
+               (command.function_code == ModbusFunctionCode::WRITE_SINGLE_REGISTER ||
+                command.function_code == ModbusFunctionCode::WRITE_MULTIPLE_REGISTERS) &&
+               command.register_count > 0 && command.payload.size() >= command.register_count * 2u;
+    }
+
+    // Only touch the queue when a write waits behind a read, or when two
+    // writes hit the same register or (with writeMultiple) adjacent ones
+    template<typename It>
+    static bool needsReorder(It begin, It end, bool writeMultiple) {
+        bool afterRead = false;
+        for (It it = begin; it != end; ++it) {
+            if (!isWrite(**it)) {
+                afterRead = true;
+                continue;
+            }
+            if (afterRead) {
+                return true;
+            }
+            uint32_t first = (*it)->register_address;
+            uint32_t last = first + (*it)->register_count;
+            for (It other = begin; other != it; ++other) {
+                uint32_t otherFirst = (*other)->register_address;
+                uint32_t otherLast = otherFirst + (*other)->register_count;
+                bool overlap = first < otherLast && otherFirst < last;
+                bool adjacent = first == otherLast || otherFirst == last;
+                if (overlap || (writeMultiple && adjacent)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Insert sorted by address, so adjacent registers end up next to each other
+    void set(uint16_t address, uint16_t value, size_t source) {
+        uint8_t i = 0;
+        while (i < count && pending[i].address < address) {
+            i++;
+        }
+        if (i < count && pending[i].address == address) {
+            superseded++;
+            pending[i].value = value;
+            pending[i].sources |= uint32_t(1) << source;
+            return;
+        }
+        for (uint8_t j = count; j > i; j--) {
+            pending[j] = pending[j - 1];
+        }
+        pending[i] = Register{address, value, uint32_t(1) << source};
+        count++;
+    }
+};
+
+// ============================================================================
+// State Snapshot
+// ============================================================================
+
+// Restored with a globals entry; the layout is a hash of the entity list, so
+// states saved by a firmware with other entities are not restored
+template<size_t N>
+struct StateSnapshot {
+    uint32_t layout;
+    float values[N];
+};
+
+// Sensors, numbers and binary sensors; NAN when the entity has no state yet
+template<typename T>
+void snapshotSave(float& slot, T* entity) {
+    slot = entity->has_state() ? static_cast<float>(entity->state) : NAN;
+}
+
+template<typename T>
+void snapshotRestore(float slot, T* entity) {
+    if (!std::isnan(slot)) {
+        entity->publish_state(static_cast<decltype(entity->state)>(slot));
+    }
+}
+
+// Selects, saved by option index
+template<typename T>
+void snapshotSaveIndex(float& slot, T* entity) {
+    auto index = entity->active_index();
+    slot = index.has_value() ? static_cast<float>(*index) : NAN;
+}
+
+template<typename T>
+void snapshotRestoreIndex(float slot, T* entity) {
+    if (!std::isnan(slot)) {
+        auto option = entity->at(static_cast<size_t>(slot));
+        if (option.has_value()) {
+            entity->publish_state(*option);
+        }
+    }
+}
+
+struct ModbusRangeAccess : esphome::modbus_controller::ModbusController {
+    static auto& ranges(esphome::modbus_controller::ModbusController* controller) {
+        return controller->*(&ModbusRangeAccess::register_ranges_);
+    }
+};
+
+// Read the ranges with at least minSkipUpdates skipped updates only after
+// the next cycles updates, called after the controller setup
+inline void deferRanges(esphome::modbus_controller::ModbusController* controller, uint16_t minSkipUpdates,
+                        uint16_t cycles) {
+    for (auto& range : ModbusRangeAccess::ranges(controller)) {
+        if (range.skip_updates >= minSkipUpdates && range.skip_updates_counter < cycles) {
+            range.skip_updates_counter = cycles;
+        }
+    }
+}
+
+// ============================================================================
+// Enum Tables
+// ============================================================================
+
+// One entry of a value to text table, written by the model generator to
+// models/<model>-enums.h; the entries are sorted by value
+struct EnumEntry {
+    int32_t value;
+    const char* text;
+};
+
+// Text of value, fallback when the table has none (binary search)
+template<size_t N>
+const char* enumLookup(const EnumEntry (&table)[N], int32_t value, const char* fallback = nullptr) {
+    size_t low = 0;
+    size_t high = N;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (table[middle].value < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < N && table[low].value == value ? table[low].text : fallback;
+}
+
+// Text of value, the prefix followed by the number when the table has none
+template<size_t N>
+std::string enumText(const EnumEntry (&table)[N], int32_t value, const char* prefix = "Unknown: ") {
+    const char* text = enumLookup(table, value);
+    return text != nullptr ? std::string(text) : prefix + std::to_string(value);
+}
+
+RegisterCache register_cache;
+RegisterFlags register_flags(register_cache);
+ModbusWriteLane write_lane;
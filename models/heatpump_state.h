@@ -0,0 +1,142 @@
+/*
+ * Heat Pump State Endpoint
+ * Raw register snapshot of every planned read range, served by the web
+ * server in one request, for dashboards and building management systems
+ * that would otherwise fetch each entity on its own.
+ *
+ * The buffer holds the registers exactly as the last read response of each
+ * range carried them. It is filled from the bus statistics (every valid
+ * read response, see heatpump_bus_stats.h), so nothing is formatted per
+ * request or per entity; a request only copies the buffer.
+ *
+ *   /state.bin  "HPS1", layout (uint32), millis() of the last update
+ *               (uint32), then per read range the millis() of its last
+ *               response (uint32, 0 = not read yet) and its registers
+ *               (uint16 each, big endian as on the wire). The other
+ *               fields are little endian.
+ *
+ * The ranges and the entities in them are written by the model generator,
+ * which also writes the layout to models/<model>-state.json: the byte
+ * offset of every range and entity, with value type, bitmask, unit and
+ * scale. The layout field is a hash of that file, so a poller can tell when
+ * the firmware was updated with a different layout.
+ *
+ * The web server runs in a task of its own. Each update() is bracketed by a
+ * sequence counter, and a request copies the buffer again when an update
+ * ran while it was copying, so every range is served from one response.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "esphome/components/web_server_base/web_server_base.h"
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+// Number of read ranges in the buffer
+#ifndef STATE_MAX_RANGES
+#define STATE_MAX_RANGES 32
+#endif
+
+// Attempts to copy a consistent buffer before it is served as it is
+#define STATE_COPY_ATTEMPTS 4
+
+// ============================================================================
+// State Endpoint
+// ============================================================================
+
+class StateEndpoint : public AsyncWebHandler {
+public:
+    uint32_t requests = 0;  // Requests served
+    uint32_t updates = 0;   // Read responses taken over
+
+    // Layout hash from the model generator, called at boot before addRange()
+    void configure(uint32_t layout) {
+        buffer.assign(HEADER_SIZE, 0);
+        memcpy(buffer.data(), "HPS1", 4);
+        memcpy(buffer.data() + 4, &layout, 4);
+        rangeCount = 0;
+    }
+
+    // Read request of the plan: Modbus function (3 holding, 4 input), first
+    // register and register count
+    void addRange(uint8_t function, uint16_t start, uint16_t count) {
+        if (rangeCount == STATE_MAX_RANGES) {
+            return;
+        }
+        ranges[rangeCount++] = Range{function, start, count, static_cast<uint16_t>(buffer.size())};
+        buffer.resize(buffer.size() + 4 + count * 2, 0);
+    }
+
+    // Serve the buffer, called at boot after the web server is set up
+    void attach() {
+        esphome::web_server_base::global_web_server_base->add_handler(this);
+    }
+
+    // Valid read response: the register bytes after the byte count
+    void update(uint8_t function, uint16_t start, uint16_t count, const uint8_t* data, uint32_t now) {
+        for (uint8_t i = 0; i < rangeCount; i++) {
+            const Range& range = ranges[i];
+            if (range.function != function || range.start != start || range.count != count) {
+                continue;
+            }
+            uint32_t at = now != 0 ? now : 1;
+            sequence.fetch_add(1, std::memory_order_acq_rel);
+            memcpy(buffer.data() + 8, &at, 4);
+            memcpy(buffer.data() + range.offset, &at, 4);
+            memcpy(buffer.data() + range.offset + 4, data, count * 2);
+            sequence.fetch_add(1, std::memory_order_release);
+            updates++;
+            return;
+        }
+    }
+
+    bool canHandle(AsyncWebServerRequest* request) override {
+        return request->url() == "/state.bin";
+    }
+
+    void handleRequest(AsyncWebServerRequest* request) override {
+        std::vector<uint8_t> copy(buffer.size());
+        for (uint8_t attempt = 0; attempt < STATE_COPY_ATTEMPTS; attempt++) {
+            uint32_t before = sequence.load(std::memory_order_acquire);
+            memcpy(copy.data(), buffer.data(), copy.size());
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((before & 1) == 0 && sequence.load(std::memory_order_relaxed) == before) {
+                break;
+            }
+        }
+        requests++;
+        request->send(request->beginResponse(200, "application/octet-stream", copy.data(), copy.size()));
+    }
+
+    bool isRequestHandlerTrivial() override {
+        return false;
+    }
+
+private:
+    static constexpr uint16_t HEADER_SIZE = 12;
+
+    struct Range {
+        uint8_t function;
+        uint16_t start;
+        uint16_t count;
+        uint16_t offset;  // Byte offset of the range in the buffer
+    };
+
+    Range ranges[STATE_MAX_RANGES];
+    uint8_t rangeCount = 0;
+
+    // Sized at boot, not resized afterwards
+    std::vector<uint8_t> buffer = std::vector<uint8_t>(HEADER_SIZE, 0);
+
+    // Odd while update() writes the buffer
+    std::atomic<uint32_t> sequence{0};
+};
+
+StateEndpoint state_endpoint;
@@ -0,0 +1,166 @@
+/*
+ * Heat Pump Tank Schedule
+ * Domestic hot water heating on a weekly schedule, run on the ESP so it
+ * keeps working without Home Assistant and stops the heating in the poll
+ * that reports the target temperature.
+ *
+ * The schedule is a table of up to TANK_SCHEDULE_WINDOWS time windows, kept
+ * in a restored global and set from Home Assistant with the
+ * set_tank_schedule action. Each window has its weekdays, start and end
+ * (minute of the day, a window that ends before it starts runs over
+ * midnight), a target tank temperature and a hysteresis. The schedule only
+ * acts while its switch is on.
+ *
+ * While a window is open, forced tank heating is turned on when the tank
+ * temperature T5 is at or below target - hysteresis. Forced tank heating is
+ * turned off when T5 reaches the target, also outside the windows (then the
+ * target is the DHW setpoint T5s), right from the T5 update. When a window
+ * closes, heating that the schedule turned on is turned off.
+ *
+ * Windows only open once the time is known; the off at the target does not
+ * need it.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "esphome/components/switch/switch.h"
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+#define TANK_SCHEDULE_WINDOWS 8
+#define TANK_MINUTES_PER_DAY 1440
+
+// ============================================================================
+// Tank Schedule
+// ============================================================================
+
+struct TankWindow {
+    uint8_t days;        // Bit 0 Monday .. bit 6 Sunday, 0 = not used
+    uint16_t start;      // Minute of the day the window opens
+    uint16_t end;        // Minute of the day it closes
+    uint8_t target;      // Tank temperature (°C) at which heating stops
+    uint8_t hysteresis;  // Heating starts at target - hysteresis
+};
+
+// Kept in a restored global
+struct TankScheduleTable {
+    TankWindow windows[TANK_SCHEDULE_WINDOWS];
+};
+
+class TankSchedule {
+public:
+    uint32_t starts = 0;  // Heating turned on by the schedule
+    uint32_t stops = 0;   // Heating turned off at the target or window end
+
+    // Set one window from the API action, days 0 clears it. False when a
+    // value is out of range.
+    static bool set(TankScheduleTable& table, int slot, int days, int start, int end, int target,
+                    int hysteresis) {
+        if (slot < 0 || slot >= TANK_SCHEDULE_WINDOWS || days < 0 || days > 0x7F || start < 0 ||
+            start >= TANK_MINUTES_PER_DAY || end < 0 || end >= TANK_MINUTES_PER_DAY || target < 0 ||
+            target > 80 || hysteresis < 0 || hysteresis > target) {
+            return false;
+        }
+        table.windows[slot] = TankWindow{static_cast<uint8_t>(days), static_cast<uint16_t>(start),
+                                         static_cast<uint16_t>(end), static_cast<uint8_t>(target),
+                                         static_cast<uint8_t>(hysteresis)};
+        return true;
+    }
+
+    // Called from an interval. weekday is ESPTime::day_of_week (1 = Sunday),
+    // 0 while the time is not known; t5s is the DHW setpoint.
+    void service(const TankScheduleTable& table, bool enabled, uint8_t weekday, uint16_t minute, float t5,
+                 float t5s, esphome::switch_::Switch* heating) {
+        this->enabled = enabled;
+        timeKnown = weekday != 0;
+        // Turning the schedule off ends the heating it started, like a window end
+        int8_t open = enabled && timeKnown ? openWindow(table, (weekday + 5) % 7, minute) : -1;
+        if (open != window || !enabled) {
+            if (owned && heating->state) {
+                heating->turn_off();
+                stops++;
+            }
+            owned = false;
+            window = open;
+        }
+        if (!enabled) {
+            return;
+        }
+        if (window >= 0) {
+            target = table.windows[window].target;
+            hysteresis = table.windows[window].hysteresis;
+            closesAt = table.windows[window].end;
+        } else {
+            target = std::isnan(t5s) ? 0 : t5s;
+        }
+        onTemperature(t5, heating);
+    }
+
+    // New tank temperature, called from the T5 sensor
+    void onTemperature(float t5, esphome::switch_::Switch* heating) {
+        if (!enabled || std::isnan(t5) || target <= 0) {
+            return;
+        }
+        if (heating->state) {
+            if (t5 >= target) {
+                heating->turn_off();
+                owned = false;
+                stops++;
+            }
+        } else if (window >= 0 && t5 <= target - hysteresis) {
+            heating->turn_on();
+            owned = true;
+            starts++;
+        }
+    }
+
+    // "window 2 until 06:30, target 50°C" for a text sensor
+    std::string summary() const {
+        char text[48];
+        if (!enabled) {
+            return "off";
+        }
+        if (window >= 0) {
+            snprintf(text, sizeof(text), "window %d until %02u:%02u, target %.0f°C", window + 1,
+                     (unsigned) (closesAt / 60), (unsigned) (closesAt % 60), target);
+        } else if (!timeKnown) {
+            snprintf(text, sizeof(text), "time not set, stop at %.0f°C", target);
+        } else {
+            snprintf(text, sizeof(text), "no window, stop at %.0f°C", target);
+        }
+        return text;
+    }
+
+private:
+    bool enabled = false;
+    bool timeKnown = false;
+    int8_t window = -1;  // Open window, -1 for none
+    bool owned = false;  // Heating was turned on by the schedule in this window
+    float target = 0;
+    float hysteresis = 0;
+    uint16_t closesAt = 0;
+
+    // First window that is open; day 0 is Monday
+    static int8_t openWindow(const TankScheduleTable& table, uint8_t day, uint16_t minute) {
+        uint8_t yesterday = (day + 6) % 7;
+        for (uint8_t i = 0; i < TANK_SCHEDULE_WINDOWS; i++) {
+            const TankWindow& w = table.windows[i];
+            bool open = w.start <= w.end
+                            ? (w.days >> day & 1) && minute >= w.start && minute < w.end
+                            : ((w.days >> day & 1) && minute >= w.start) || ((w.days >> yesterday & 1) && minute < w.end);
+            if (open) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+TankSchedule tank_schedule;
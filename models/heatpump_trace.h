@@ -0,0 +1,219 @@
+/*
+ * Heat Pump Sample Trace
+ * Ring buffer with every sample of the traced sensors (`trace: true` in
+ * the model files, see DEVELOPMENT.md), for defrost and short-cycle
+ * analysis without publishing every sample to Home Assistant.
+ *
+ * Each traced sensor is a channel. The samples are added by a filter in
+ * front of the publish filter, so they have their final scale. Per channel
+ * the min, max and mean since the last takeStats() are kept for the
+ * downsampled sensors.
+ *
+ * The buffer is served by the web server:
+ *   /trace.csv  header "ms,<channel name>,...", then one line per sample,
+ *               oldest first, with the value in the column of its channel
+ *   /trace.bin  "HPT1", channel count (uint8), per channel a name length
+ *               (uint8) and name, then per sample the millis() (uint32),
+ *               channel (uint8) and value (float), little endian
+ *
+ * A burst polls the Modbus controller faster for a while, then restores
+ * its update interval.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "esphome/components/modbus_controller/modbus_controller.h"
+#include "esphome/components/web_server_base/web_server_base.h"
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+// Samples kept in the ring buffer (12 bytes each). The CSV response is
+// built in memory, about 15 bytes per sample.
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 1024
+#endif
+
+#define TRACE_MAX_CHANNELS 8
+
+// ============================================================================
+// Sample Trace
+// ============================================================================
+
+struct TraceStats {
+    float min;
+    float max;
+    float mean;
+};
+
+class SampleTrace : public AsyncWebHandler {
+public:
+    uint32_t samples = 0;  // Samples added since boot
+
+    void setName(uint8_t channel, const char* name) {
+        if (channel < TRACE_MAX_CHANNELS) {
+            names[channel] = name;
+            channels = channel + 1 > channels ? channel + 1 : channels;
+        }
+    }
+
+    // Serve the buffer, called at boot after the web server is set up
+    void attach() {
+        esphome::web_server_base::global_web_server_base->add_handler(this);
+    }
+
+    void add(uint8_t channel, float value, uint32_t now) {
+        if (channel >= TRACE_MAX_CHANNELS || std::isnan(value)) {
+            return;
+        }
+        records[head] = Record{now, value, channel};
+        head = (head + 1) % TRACE_SIZE;
+        if (count < TRACE_SIZE) {
+            count++;
+        }
+        samples++;
+
+        Window& window = windows[channel];
+        window.min = window.count == 0 || value < window.min ? value : window.min;
+        window.max = window.count == 0 || value > window.max ? value : window.max;
+        window.sum += value;
+        window.count++;
+    }
+
+    // Min, max and mean since the last call, NAN without samples
+    TraceStats takeStats(uint8_t channel) {
+        if (channel >= TRACE_MAX_CHANNELS || windows[channel].count == 0) {
+            return TraceStats{NAN, NAN, NAN};
+        }
+        Window& window = windows[channel];
+        TraceStats stats{window.min, window.max, static_cast<float>(window.sum / window.count)};
+        window = Window();
+        return stats;
+    }
+
+    // Poll every intervalMs for durationMs, called from a button
+    void startBurst(esphome::modbus_controller::ModbusController* controller, uint32_t intervalMs,
+                    uint32_t durationMs, uint32_t now) {
+        if (burstController == nullptr) {
+            normalInterval = controller->get_update_interval();
+        }
+        burstController = controller;
+        burstEnd = now + durationMs;
+        controller->set_update_interval(intervalMs);
+        controller->start_poller();
+    }
+
+    // Ends a burst, called from an interval
+    void service(uint32_t now) {
+        if (burstController != nullptr && static_cast<int32_t>(now - burstEnd) >= 0) {
+            burstController->set_update_interval(normalInterval);
+            burstController->start_poller();
+            burstController = nullptr;
+        }
+    }
+
+    bool bursting() const {
+        return burstController != nullptr;
+    }
+
+    bool canHandle(AsyncWebServerRequest* request) override {
+        std::string url = request->url();
+        return url == "/trace.csv" || url == "/trace.bin";
+    }
+
+    void handleRequest(AsyncWebServerRequest* request) override {
+        if (request->url() == "/trace.bin") {
+            std::vector<uint8_t> data = binary();
+            request->send(request->beginResponse(200, "application/octet-stream", data.data(), data.size()));
+            return;
+        }
+        AsyncResponseStream* stream = request->beginResponseStream("text/csv");
+        stream->print("ms");
+        for (uint8_t channel = 0; channel < channels; channel++) {
+            stream->printf(",%s", name(channel));
+        }
+        stream->print("\n");
+        for (uint16_t i = 0; i < count; i++) {
+            const Record& record = at(i);
+            stream->printf("%u%.*s,%g%.*s\n", (unsigned) record.at, record.channel, COMMAS, record.value,
+                           channels - 1 - record.channel, COMMAS);
+        }
+        request->send(stream);
+    }
+
+    bool isRequestHandlerTrivial() override {
+        return false;
+    }
+
+private:
+    struct Record {
+        uint32_t at;
+        float value;
+        uint8_t channel;
+    };
+
+    struct Window {
+        float min = 0;
+        float max = 0;
+        double sum = 0;
+        uint32_t count = 0;
+    };
+
+    Record records[TRACE_SIZE];
+    uint16_t head = 0;
+    uint16_t count = 0;
+
+    static constexpr const char* COMMAS = ",,,,,,,,";  // TRACE_MAX_CHANNELS
+
+    const char* names[TRACE_MAX_CHANNELS] = {};
+    uint8_t channels = 0;
+    Window windows[TRACE_MAX_CHANNELS];
+
+    esphome::modbus_controller::ModbusController* burstController = nullptr;
+    uint32_t normalInterval = 0;
+    uint32_t burstEnd = 0;
+
+    // Oldest sample first
+    const Record& at(uint16_t index) const {
+        return records[(head + TRACE_SIZE - count + index) % TRACE_SIZE];
+    }
+
+    const char* name(uint8_t channel) const {
+        return names[channel] != nullptr ? names[channel] : "";
+    }
+
+    static void put(std::vector<uint8_t>& data, const void* value, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(value);
+        data.insert(data.end(), bytes, bytes + size);
+    }
+
+    // The ESP32 is little endian, values are copied as they are
+    std::vector<uint8_t> binary() const {
+        std::vector<uint8_t> data;
+        data.reserve(5 + channels * 32 + count * 9);
+        put(data, "HPT1", 4);
+        data.push_back(channels);
+        for (uint8_t channel = 0; channel < channels; channel++) {
+            size_t length = strlen(name(channel));
+            data.push_back(static_cast<uint8_t>(length));
+            put(data, name(channel), length);
+        }
+        for (uint16_t i = 0; i < count; i++) {
+            const Record& record = at(i);
+            put(data, &record.at, 4);
+            data.push_back(record.channel);
+            put(data, &record.value, 4);
+        }
+        return data;
+    }
+};
+
+SampleTrace sample_trace;
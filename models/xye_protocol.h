@@ -17,7 +17,12 @@
  *     - Used by: Some RS485 units, water-based systems
  *     - See: github.com/mdrobnak/esphome midea_xye component
  *
+ *   The variant is a template parameter of XYEState (XYEVariantA or
+ *   XYEVariantB), so both can be used in one firmware. The global xyeState
+ *   uses XYE_DEFAULT_VARIANT (Variant A unless overridden by a build flag).
+ *
  * Communication: 4800 baud, 8N1
+ *   A 32-byte response takes ~67 ms on the wire (10 bits per byte).
  * 
  * Command Packet Structure (16 bytes, Variant A):
  *   [0x00]  0xAA - Start byte (preamble)
@@ -40,7 +45,7 @@
  * Response Packet Structure (32 bytes):
  *   [0]  0xAA - Start byte
  *   [1]  0xC0 - Response type (echo of command)
- *   [2]  0x00/0x80 - Direction/destination
+ *   [2]  Server ID of the unit that answered (as in the query)
  *   [3-5] Destination/source bytes
  *   [6]  Unknown
  *   [7]  Capabilities flags (0x80=ext_temp, 0x10=swing)
@@ -91,11 +96,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstring>
-#include <sstream>
-#include <iomanip>
-#include <string>
 
 // Arduino/ESP32 includes
 #include <Arduino.h>
@@ -113,18 +116,27 @@
 // Protocol Constants - Command Packet Indices
 // ============================================================================
 
+#define SEND_SERVER_ID 2 // Address of the unit the packet is for
 #define SEND_FAN    7   // Fan mode byte position
 #define SEND_TEMP   8   // Temperature setpoint position
 #define SEND_TIMER1 9   // Timer value 1 position
 #define SEND_TIMER2 10  // Timer value 2 position
 #define SEND_MODE   11  // Operating mode byte position (0x0B per Flachzange fix)
+#define SEND_MODE_B 6   // Operating mode byte position in Variant B
+#define SEND_FLAGS_B 12 // Mode flags byte position in Variant B
+#define SEND_CMD_CHECK 13 // Inverted command type (0x3C for set, 0x3F for query)
 #define SEND_CRC    14  // CRC byte position (0x0E)
 #define SEND_LEN    16  // Total command length
 
+#define XYE_PREAMBLE 0xAA  // First byte of every packet
+#define XYE_PROLOGUE 0x55  // Last byte of every packet
+
 // ============================================================================
 // Protocol Constants - Response Packet Indices
 // ============================================================================
 
+#define REC_SERVER_ID   2   // Server ID of the unit that answered
+#define CAP_INDEX       7   // Capabilities flags
 #define REC_MODE        8   // Operating mode in response
 #define REC_FAN         9   // Fan mode in response
 #define REC_TEMP        10  // Temperature setpoint in response
@@ -142,6 +154,10 @@
 #define PROT1_INDEX     24  // Protection flags (low byte)
 #define PROT2_INDEX     25  // Protection flags (high byte)
 #define CCM_ERR_INDEX   26  // CCM communication error flags
+#define REC_CRC         30  // CRC byte position in response
+#define REC_LEN         32  // Total response length
+
+#define XYE_BIT(index) (1UL << (index))  // Byte mask for XYEState::changedAny()
 
 // ============================================================================
 // Mode Flags (Byte 20 in response, Byte 12 in command for Variant B)
@@ -211,6 +227,274 @@
 #define FAN_MEDIUM_LOW 0x03  // Medium-Low (some units only)
 #define FAN_LOW        0x04  // Low speed (NOT 0x03 per Flachzange fix)
 
+// ============================================================================
+// Text Formatting
+// ============================================================================
+//
+// Lookup tables and fixed-buffer formatters for entity states and logs.
+// Nothing here allocates, so formatting every frame does not fragment the
+// heap on long uptimes.
+
+inline const char* xyeModeName(uint8_t mode) {
+    switch (mode) {
+        case MODE_OFF:      return "Off";
+        case MODE_AUTO:     return "Auto";
+        case MODE_AUTO_ALT: return "Auto";  // Some units use 0x80
+        case MODE_COOL:     return "Cool";
+        case MODE_DRY:      return "Dry";
+        case MODE_HEAT:     return "Heat";
+        case MODE_FAN_ONLY: return "Fan Only";
+        default:            return "Unknown";
+    }
+}
+
+inline const char* xyeFanName(uint8_t fan) {
+    switch (fan) {
+        case FAN_AUTO:       return "Auto";
+        case FAN_HIGH:       return "High";
+        case FAN_MEDIUM:     return "Medium";
+        case FAN_MEDIUM_LOW: return "Medium-Low";
+        case FAN_LOW:        return "Low";
+        default:             return "Unknown";
+    }
+}
+
+// Short names of the common error codes (see Known Error Codes above),
+// nullptr for codes without a name
+inline const char* xyeErrorName(uint8_t code) {
+    static const char* const names[] = {
+        nullptr,
+        "Comm",      // 1: Indoor/outdoor communication
+        "IndoorT",   // 2: Indoor temp sensor
+        "CoilT",     // 3: Coil temp sensor
+        "OutdoorT",  // 4: Outdoor temp sensor
+        "OutCoilT",  // 5: Outdoor coil sensor
+        "CompOL",    // 6: Compressor overload
+        "CompOC",    // 7: Compressor overcurrent
+        "HighP",     // 8: High pressure
+        "LowP",      // 9: Low pressure
+        "Phase",     // 10: Phase error
+        "OutFan",    // 11: Outdoor fan error
+        "IndFan",    // 12: Indoor fan error
+        "EEPROM",    // 13: EEPROM error
+        "Voltage",   // 14: Power voltage error
+        "Freeze",    // 15: Freeze protection
+    };
+    return code < sizeof(names) / sizeof(names[0]) ? names[code] : nullptr;
+}
+
+struct XYEFlagName {
+    uint8_t mask;
+    const char* name;
+};
+
+// Mode flags (byte 20); 0x80 alone marks ventilation on the units seen so far
+static const XYEFlagName XYE_MODE_FLAG_NAMES[] = {
+    {MODE_FLAG_ECO, "ECO"},
+    {MODE_FLAG_AUX_HEAT, "BOOST"},
+    {MODE_FLAG_SWING, "SWING"},
+    {0x80, "VENT"},
+};
+
+// Operation flags (byte 21)
+static const XYEFlagName XYE_OP_FLAG_NAMES[] = {
+    {OP_FLAG_WATER_PUMP, "PUMP"},
+    {OP_FLAG_WATER_LOCK, "W-LOCK"},
+};
+
+// Text in a fixed buffer. Appends that do not fit are cut off, the buffer
+// always stays NUL terminated.
+template <size_t N>
+class XYEText {
+public:
+    XYEText& add(const char* text) {
+        while (*text != '\0' && len < N - 1) {
+            buf[len++] = *text++;
+        }
+        buf[len] = '\0';
+        return *this;
+    }
+    
+    XYEText& add(char c) {
+        if (len < N - 1) {
+            buf[len++] = c;
+            buf[len] = '\0';
+        }
+        return *this;
+    }
+    
+    // Two uppercase hex digits
+    XYEText& hex(uint8_t value) {
+        static const char digits[] = "0123456789ABCDEF";
+        add(digits[value >> 4]);
+        return add(digits[value & 0x0F]);
+    }
+    
+    XYEText& dec(uint32_t value) {
+        char tmp[10];
+        uint8_t n = 0;
+        do {
+            tmp[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+        while (n > 0) {
+            add(tmp[--n]);
+        }
+        return *this;
+    }
+    
+    const char* c_str() const { return buf; }
+    size_t length() const { return len; }
+    bool empty() const { return len == 0; }
+    
+private:
+    char buf[N] = {0};
+    size_t len = 0;
+};
+
+// "AA C0 00 ..." or, with a prefix, "0xAA 0xC0 0x00 ..."
+template <size_t N>
+void xyeFormatHex(XYEText<N>& out, const uint8_t* data, uint8_t len, const char* prefix = "") {
+    for (uint8_t i = 0; i < len; i++) {
+        if (i > 0) out.add(' ');
+        out.add(prefix).hex(data[i]);
+    }
+}
+
+// Names of the set flags separated by spaces; returns false when none of
+// the named flags is set
+template <size_t N, size_t M>
+bool xyeFormatFlags(XYEText<N>& out, uint8_t value, const XYEFlagName (&names)[M]) {
+    bool any = false;
+    for (size_t i = 0; i < M; i++) {
+        if (value & names[i].mask) {
+            if (any) out.add(' ');
+            out.add(names[i].name);
+            any = true;
+        }
+    }
+    return any;
+}
+
+// Error bytes 22/23 as "No Errors", "Comm" or "HighP+E17"
+template <size_t N>
+void xyeFormatErrors(XYEText<N>& out, uint8_t e1, uint8_t e2) {
+    if (e1 == 0 && e2 == 0) {
+        out.add("No Errors");
+        return;
+    }
+    uint8_t codes[2] = {e1, e2};
+    for (uint8_t i = 0; i < 2 && codes[i] != 0; i++) {
+        if (i > 0) out.add('+');
+        const char* name = xyeErrorName(codes[i]);
+        if (name != nullptr) {
+            out.add(name);
+        } else {
+            out.add('E').dec(codes[i]);
+        }
+    }
+}
+
+// Protection bytes 24/25 as the numbers of the set bits ("P0 P9"), the
+// meaning of the individual bits differs between units
+template <size_t N>
+void xyeFormatProtection(XYEText<N>& out, uint8_t p1, uint8_t p2) {
+    uint16_t flags = (p2 << 8) | p1;
+    if (flags == 0) {
+        out.add("None");
+        return;
+    }
+    for (uint8_t bit = 0; bit < 16; bit++) {
+        if (flags & (1U << bit)) {
+            if (!out.empty()) out.add(' ');
+            out.add('P').dec(bit);
+        }
+    }
+}
+
+// ============================================================================
+// Receive Timing
+// ============================================================================
+
+// Maximum time between a query/command and the end of its response
+#ifndef XYE_RESPONSE_TIMEOUT_MS
+#define XYE_RESPONSE_TIMEOUT_MS 500
+#endif
+
+// A gap this long inside a frame means the rest of the frame was lost
+// (one byte takes ~2 ms at 4800 baud)
+#ifndef XYE_INTERBYTE_TIMEOUT_MS
+#define XYE_INTERBYTE_TIMEOUT_MS 20
+#endif
+
+// ============================================================================
+// Query Scheduling (defaults, can be overridden from YAML substitutions)
+// ============================================================================
+
+// Poll interval right after a command or a mode change
+#ifndef XYE_POLL_FAST_MS
+#define XYE_POLL_FAST_MS 2000
+#endif
+
+// Longest poll interval while the unit sits idle in steady state
+#ifndef XYE_POLL_SLOW_MS
+#define XYE_POLL_SLOW_MS 15000
+#endif
+
+// How long to keep polling at the fast interval after a command/mode change
+#ifndef XYE_FAST_WINDOW_MS
+#define XYE_FAST_WINDOW_MS 30000
+#endif
+
+// Immediate retries after a query timeout before falling back to the
+// normal interval (keeps a unit that is off the bus from flooding it)
+#ifndef XYE_QUERY_RETRIES
+#define XYE_QUERY_RETRIES 2
+#endif
+
+// Consecutive timeouts after which a unit is reported offline
+#ifndef XYE_OFFLINE_AFTER
+#define XYE_OFFLINE_AFTER 3
+#endif
+
+// ============================================================================
+// Command Queue
+// ============================================================================
+
+// Number of pending commands that can be queued (no heap is used)
+#ifndef XYE_CMD_QUEUE_LEN
+#define XYE_CMD_QUEUE_LEN 4
+#endif
+
+// Fields carried by a queued 0xC3 set command
+#define XYE_FIELD_MODE  0x01
+#define XYE_FIELD_FAN   0x02
+#define XYE_FIELD_TEMP  0x04
+#define XYE_FIELD_FLAGS 0x08  // Variant B only
+
+// Command types
+#define XYE_CMD_QUERY  0xC0
+#define XYE_CMD_SET    0xC3
+#define XYE_CMD_LOCK   0xCC
+#define XYE_CMD_UNLOCK 0xCD
+
+// ============================================================================
+// Diagnostics
+// ============================================================================
+
+// Packet dump level, set with the xye_debug_level substitution
+//   0: no packet formatting is compiled in; byte changes are only recorded
+//      in XYEState::changeLog
+//   1: sniff mode logs every TX/RX packet, its decode and each changed byte
+#ifndef XYE_DEBUG_LEVEL
+#define XYE_DEBUG_LEVEL 0
+#endif
+
+// Number of recent frames with byte changes kept by XYEChangeLog
+#ifndef XYE_CHANGE_LOG_LEN
+#define XYE_CHANGE_LOG_LEN 16
+#endif
+
 // ============================================================================
 // Serial Interface
 // ============================================================================
@@ -223,105 +507,977 @@
     HardwareSerial xyeSerial(2);  // UART2 on ESP32
 #endif
 
+// ============================================================================
+// Packet Builder
+// ============================================================================
+//
+// Command packets are built with constexpr functions, so the constant
+// packets below are computed and checked by the compiler. Variable packets
+// start from a constant template and only the changed bytes are patched,
+// with the CRC updated incrementally.
+
+// CRC used by both command and response packets:
+// 0xFF - (sum of all bytes except the CRC byte itself)
+constexpr uint8_t xyeCrc(const uint8_t* data, uint8_t len, uint8_t crcIndex) {
+    uint8_t sum = 0;
+    for (uint8_t i = 0; i < len; i++) {
+        if (i != crcIndex) {
+            sum += data[i];
+        }
+    }
+    return 0xFF - sum;
+}
+
+struct XYEPacket {
+    uint8_t bytes[SEND_LEN];
+    
+    // Change one byte and keep the CRC valid without summing the packet again
+    void patch(uint8_t index, uint8_t value) {
+        bytes[SEND_CRC] -= value - bytes[index];
+        bytes[index] = value;
+    }
+};
+
+// Build a complete command packet. modeIndex selects the protocol variant
+// (SEND_MODE for Variant A, SEND_MODE_B for Variant B).
+constexpr XYEPacket xyeBuildPacket(uint8_t type, uint8_t mode = MODE_OFF, uint8_t fan = 0x00,
+                                   uint8_t temp = 0x00, uint8_t modeIndex = SEND_MODE) {
+    XYEPacket packet = {{0}};
+    packet.bytes[0] = XYE_PREAMBLE;
+    packet.bytes[1] = type;
+    packet.bytes[4] = 0x80;                      // Direction marker
+    packet.bytes[modeIndex] = mode;
+    packet.bytes[SEND_FAN] = fan;
+    packet.bytes[SEND_TEMP] = temp;
+    packet.bytes[SEND_CMD_CHECK] = type ^ 0xFF;  // Inverted command byte
+    packet.bytes[SEND_LEN - 1] = XYE_PROLOGUE;
+    packet.bytes[SEND_CRC] = xyeCrc(packet.bytes, SEND_LEN, SEND_CRC);
+    return packet;
+}
+
+constexpr XYEPacket XYE_QUERY_PACKET  = xyeBuildPacket(XYE_CMD_QUERY);
+constexpr XYEPacket XYE_SET_PACKET    = xyeBuildPacket(XYE_CMD_SET);
+constexpr XYEPacket XYE_LOCK_PACKET   = xyeBuildPacket(XYE_CMD_LOCK);
+constexpr XYEPacket XYE_UNLOCK_PACKET = xyeBuildPacket(XYE_CMD_UNLOCK);
+
+// Protocol constants known from bus captures
+static_assert(XYE_QUERY_PACKET.bytes[SEND_CMD_CHECK] == 0x3F, "query check byte must be 0x3F");
+static_assert(XYE_QUERY_PACKET.bytes[SEND_CRC] == 0x81, "query CRC must be 0x81");
+static_assert(XYE_SET_PACKET.bytes[SEND_CMD_CHECK] == 0x3C, "set check byte must be 0x3C");
+static_assert(XYE_LOCK_PACKET.bytes[SEND_CMD_CHECK] == 0x33, "lock check byte must be 0x33");
+static_assert(XYE_UNLOCK_PACKET.bytes[SEND_CMD_CHECK] == 0x32, "unlock check byte must be 0x32");
+static_assert(XYE_LOCK_PACKET.bytes[SEND_CRC] == 0x81 && XYE_UNLOCK_PACKET.bytes[SEND_CRC] == 0x81,
+              "type and check byte always add up to 0xFF, so lock/unlock share the query CRC");
+
+// Cool, fan auto, 72F in both variants: moving the mode byte must not change the CRC
+static_assert(xyeBuildPacket(XYE_CMD_SET, MODE_COOL, FAN_AUTO, 72).bytes[SEND_CRC] == 0x31,
+              "Variant A set packet CRC");
+static_assert(xyeBuildPacket(XYE_CMD_SET, MODE_COOL, FAN_AUTO, 72, SEND_MODE_B).bytes[SEND_CRC] == 0x31,
+              "Variant B set packet CRC");
+
+// ============================================================================
+// Protocol Variants
+// ============================================================================
+//
+// Command byte offsets per variant. The response layout is shared. Code that
+// is templated on a variant resolves these offsets at compile time, so
+// there is no runtime branching on the variant.
+
+template <uint8_t ModeIndex, uint8_t FlagsIndex>
+struct XYEVariant {
+    static constexpr uint8_t modeIndex = ModeIndex;    // Mode byte in set commands
+    static constexpr uint8_t flagsIndex = FlagsIndex;  // Mode flags byte, 0 = not sent
+};
+
+using XYEVariantA = XYEVariant<SEND_MODE, 0>;
+using XYEVariantB = XYEVariant<SEND_MODE_B, SEND_FLAGS_B>;
+
+#ifndef XYE_DEFAULT_VARIANT
+#define XYE_DEFAULT_VARIANT XYEVariantA
+#endif
+
+template <typename Variant>
+struct XYECodec {
+    static constexpr XYEPacket setTemplate() {
+        return xyeBuildPacket(XYE_CMD_SET, MODE_OFF, 0x00, 0x00, Variant::modeIndex);
+    }
+    
+    // Fill in a set command, starting from setTemplate()
+    static void encodeSet(XYEPacket& packet, uint8_t mode, uint8_t fan, uint8_t temp, uint8_t flags) {
+        packet.patch(Variant::modeIndex, mode);
+        packet.patch(SEND_FAN, fan);
+        packet.patch(SEND_TEMP, temp);
+        if (Variant::flagsIndex != 0) {
+            packet.patch(Variant::flagsIndex, flags);
+        }
+    }
+    
+    static uint8_t decodeMode(const uint8_t* response) { return response[REC_MODE]; }
+    static uint8_t decodeFan(const uint8_t* response) { return response[REC_FAN]; }
+    static uint8_t decodeTemp(const uint8_t* response) { return response[REC_TEMP]; }
+    static uint8_t decodeFlags(const uint8_t* response) { return response[MODE_FLAGS_IDX]; }
+};
+
+static_assert(XYECodec<XYEVariantA>::setTemplate().bytes[SEND_CRC] == XYE_SET_PACKET.bytes[SEND_CRC],
+              "an empty set packet is the same in both variants");
+
+// ============================================================================
+// Response Frame Parser
+// ============================================================================
+//
+// Byte-stream state machine for 32-byte responses. The parser writes into a
+// buffer owned by XYEState (see attach()). Bytes are fed one at a time as
+// they arrive from the UART:
+//   - bytes are dropped until the 0xAA preamble is seen
+//   - once 32 bytes are collected, the 0x55 prologue and the CRC at byte 30
+//     are checked
+//   - on a bad frame the buffer is rescanned from the next 0xAA, so a frame
+//     that starts inside a corrupted one is not lost
+//   - a partial frame is dropped when the line stays silent for longer than
+//     XYE_INTERBYTE_TIMEOUT_MS
+
+enum XYERxStatus : uint8_t {
+    XYE_RX_PENDING = 0,  // Nothing complete yet
+    XYE_RX_FRAME,        // A validated response is available
+    XYE_RX_TIMEOUT       // The expected response did not arrive in time
+};
+
+class XYEFrameParser {
+public:
+    // Error counters (for diagnostics)
+    uint32_t crcErrors = 0;          // Frames dropped due to a CRC mismatch
+    uint32_t framingErrors = 0;      // Frames dropped due to a missing 0x55 prologue
+    uint32_t droppedPartials = 0;    // Partial frames dropped after a line gap
+    
+    // Feed one received byte, returns true when a validated frame is available
+    bool feed(uint8_t byte, uint32_t now) {
+        lastByteAt = now;
+        if (len == 0 && byte != XYE_PREAMBLE) {
+            return false;  // Not in sync yet
+        }
+        buffer[len++] = byte;
+        if (len < REC_LEN) {
+            return false;
+        }
+        
+        if (buffer[REC_LEN - 1] != XYE_PROLOGUE) {
+            framingErrors++;
+            resync();
+            return false;
+        }
+        if (buffer[REC_CRC] != xyeCrc(buffer, REC_LEN, REC_CRC)) {
+            crcErrors++;
+            resync();
+            return false;
+        }
+        len = 0;
+        return true;
+    }
+    
+    // Drop a partial frame if the line has been silent for too long
+    void expire(uint32_t now) {
+        if (len > 0 && (now - lastByteAt) > XYE_INTERBYTE_TIMEOUT_MS) {
+            droppedPartials++;
+            len = 0;
+        }
+    }
+    
+    // True while a frame is being received
+    bool busy() const { return len > 0; }
+    
+    // Set the buffer the next frame is written into
+    void attach(uint8_t* target) {
+        buffer = target;
+        len = 0;
+    }
+    
+private:
+    uint8_t* buffer = nullptr;
+    uint8_t len = 0;
+    uint32_t lastByteAt = 0;
+    
+    // Restart parsing at the next preamble inside the rejected frame
+    void resync() {
+        uint8_t start = 1;
+        while (start < len && buffer[start] != XYE_PREAMBLE) {
+            start++;
+        }
+        len -= start;
+        std::memmove(buffer, buffer + start, len);
+    }
+};
+
+// ============================================================================
+// Query Scheduler
+// ============================================================================
+//
+// Decides when the next status query is sent:
+//   - after a command or a mode/fan/setpoint change, poll every fastInterval
+//     for fastWindow ms
+//   - after that, grow the interval by 50% per unchanged response up to
+//     slowInterval
+//   - after a timeout, retry right away (up to XYE_QUERY_RETRIES times)
+
+class XYEQueryScheduler {
+public:
+    uint32_t fastInterval = XYE_POLL_FAST_MS;
+    uint32_t slowInterval = XYE_POLL_SLOW_MS;
+    uint32_t fastWindow = XYE_FAST_WINDOW_MS;
+    uint32_t interval = XYE_POLL_FAST_MS;  // Current poll interval
+    
+    void configure(uint32_t fastMs, uint32_t slowMs, uint32_t windowMs) {
+        fastInterval = fastMs;
+        slowInterval = slowMs < fastMs ? fastMs : slowMs;
+        fastWindow = windowMs;
+        interval = fastInterval;
+    }
+    
+    // Poll fast for a while (commands, mode changes, boot)
+    void boost(uint32_t now) {
+        interval = fastInterval;
+        fastUntil = now + fastWindow;
+    }
+    
+    bool due(uint32_t now) const {
+        return retryNow || (now - lastQueryAt) >= interval;
+    }
+    
+    void onQuerySent(uint32_t now) {
+        lastQueryAt = now;
+        retryNow = false;
+    }
+    
+    // stateChanged: mode, fan, setpoint or flags differ from the last response
+    void onResponse(uint32_t now, bool stateChanged) {
+        retries = 0;
+        if (stateChanged) {
+            boost(now);
+        } else if ((int32_t) (now - fastUntil) >= 0 && interval < slowInterval) {
+            interval += interval / 2;
+            if (interval > slowInterval) {
+                interval = slowInterval;
+            }
+        }
+    }
+    
+    void onTimeout() {
+        if (retries < XYE_QUERY_RETRIES) {
+            retries++;
+            retryNow = true;
+        }
+    }
+    
+private:
+    uint32_t lastQueryAt = 0;
+    uint32_t fastUntil = XYE_FAST_WINDOW_MS;  // Poll fast after boot
+    uint8_t retries = 0;
+    bool retryNow = false;
+};
+
+// ============================================================================
+// Change Log
+// ============================================================================
+//
+// Records which response bytes changed in the last XYE_CHANGE_LOG_LEN frames
+// that changed anything, as one bitmask per frame (bit i = byte i). Recording
+// is two stores per frame, formatting is left to whoever reads the log.
+
+struct XYEChange {
+    uint32_t seq;   // XYEState::frameSeq of the frame
+    uint32_t mask;  // Changed response bytes
+};
+
+class XYEChangeLog {
+public:
+    void record(uint32_t seq, uint32_t mask) {
+        if (mask == 0) {
+            return;
+        }
+        items[head] = {seq, mask};
+        head = (head + 1) % XYE_CHANGE_LOG_LEN;
+        if (count < XYE_CHANGE_LOG_LEN) {
+            count++;
+        }
+    }
+    
+    uint8_t size() const { return count; }
+    
+    // i = 0 is the most recent entry
+    const XYEChange& recent(uint8_t i) const {
+        return items[(head + XYE_CHANGE_LOG_LEN - 1 - i) % XYE_CHANGE_LOG_LEN];
+    }
+    
+private:
+    XYEChange items[XYE_CHANGE_LOG_LEN] = {};
+    uint8_t head = 0;
+    uint8_t count = 0;
+};
+
+// "#1234:00000300 #1233:00000100 ...", newest first. A full log is longer
+// than a text sensor state (255 characters in Home Assistant) and the text
+// buffer, so only the entries that fit are listed, followed by " +N" for the
+// N older ones left out.
+template <size_t N>
+void xyeFormatChanges(XYEText<N>& out, const XYEChangeLog& log) {
+    // Room for " +16" behind the last entry that fits
+    const size_t limit = (N - 1 < 255 ? N - 1 : 255) - 4;
+    uint8_t shown = 0;
+    for (; shown < log.size(); shown++) {
+        const XYEChange& c = log.recent(shown);
+        XYEText<24> entry;
+        if (shown > 0) entry.add(' ');
+        entry.add('#').dec(c.seq).add(':');
+        for (int8_t b = 24; b >= 0; b -= 8) {
+            entry.hex(c.mask >> b);
+        }
+        if (out.length() + entry.length() > limit) {
+            break;
+        }
+        out.add(entry.c_str());
+    }
+    if (shown < log.size()) {
+        out.add(" +").dec(log.size() - shown);
+    }
+}
+
+// Response bytes that reflect the unit's operating state
+#define XYE_STATE_BYTES (XYE_BIT(REC_MODE) | XYE_BIT(REC_FAN) | XYE_BIT(REC_TEMP) | \
+                         XYE_BIT(MODE_FLAGS_IDX) | XYE_BIT(OP_FLAGS_IDX))
+
+// ============================================================================
+// Decoded Fault Status
+// ============================================================================
+
+// Response bytes decoded into XYEStatus
+#define XYE_STATUS_BYTES (XYE_BIT(ERR1_INDEX) | XYE_BIT(ERR2_INDEX) | XYE_BIT(PROT1_INDEX) | \
+                          XYE_BIT(PROT2_INDEX) | XYE_BIT(CCM_ERR_INDEX))
+
+// Bit of XYEStatus::errors for a reported error code; codes without a
+// name in xyeErrorName() (F0-F9 and unit specific ones) share bit 0
+#define XYE_ERR_OTHER 0
+#define XYE_ERR_BIT(code) (1U << (code))
+
+// Error and protection bytes 22-26, decoded once per frame. Two unit codes
+// are reported at most, so XYEStatus::errors has at most two bits set.
+struct __attribute__((packed)) XYEStatus {
+    uint16_t errors = 0;      // XYE_ERR_BIT(code) for every reported error code
+    uint16_t protection = 0;  // Protection flags, byte 25 << 8 | byte 24
+    uint8_t ccm = 0;          // CCM communication error flags, byte 26
+    
+    bool hasError(uint8_t code) const { return (errors >> code) & 1; }
+    bool any() const { return errors != 0 || protection != 0 || ccm != 0; }
+    
+    static uint16_t errorBit(uint8_t code) {
+        if (code == 0) return 0;
+        return xyeErrorName(code) != nullptr ? XYE_ERR_BIT(code) : XYE_ERR_BIT(XYE_ERR_OTHER);
+    }
+    
+    static XYEStatus decode(const uint8_t* response) {
+        XYEStatus status;
+        status.errors = errorBit(response[ERR1_INDEX]) | errorBit(response[ERR2_INDEX]);
+        status.protection = (response[PROT2_INDEX] << 8) | response[PROT1_INDEX];
+        status.ccm = response[CCM_ERR_INDEX];
+        return status;
+    }
+    
+    // Fields that differ between a and b, bit for bit
+    static XYEStatus diff(const XYEStatus& a, const XYEStatus& b) {
+        XYEStatus changes;
+        changes.errors = a.errors ^ b.errors;
+        changes.protection = a.protection ^ b.protection;
+        changes.ccm = a.ccm ^ b.ccm;
+        return changes;
+    }
+};
+
+static_assert(sizeof(XYEStatus) == 5, "XYEStatus must stay packed");
+
+// ============================================================================
+// Command Queue
+// ============================================================================
+//
+// Fixed-size ring buffer of commands waiting for the bus. Consecutive
+// changes are coalesced: a new field value is merged into the newest
+// pending set command, so changing the setpoint and then the fan while a
+// response is in flight results in a single 0xC3 frame carrying both.
+
+struct XYECommand {
+    uint8_t type = XYE_CMD_SET;  // XYE_CMD_SET, XYE_CMD_LOCK or XYE_CMD_UNLOCK
+    uint8_t fields = 0;          // XYE_FIELD_* values present (set only)
+    uint8_t mode = MODE_OFF;
+    uint8_t fan = FAN_AUTO;
+    uint8_t temp = 0;
+    uint8_t flags = MODE_FLAG_NORM;
+};
+
+class XYECommandQueue {
+public:
+    uint32_t merged = 0;     // Field changes coalesced into an already queued command
+    uint32_t overflows = 0;  // Commands dropped because the queue was full
+    
+    bool empty() const { return count == 0; }
+    uint8_t size() const { return count; }
+    const XYECommand& front() const { return items[head]; }
+    
+    void pop() {
+        if (count > 0) {
+            head = (head + 1) % XYE_CMD_QUEUE_LEN;
+            count--;
+        }
+    }
+    
+    // Queue a new value for one field of a set command
+    bool set(uint8_t field, uint8_t value) {
+        XYECommand* cmd = (count > 0 && back().type == XYE_CMD_SET) ? &back() : append(XYE_CMD_SET);
+        if (cmd == nullptr) {
+            return false;
+        }
+        if (cmd->fields != 0) {
+            merged++;
+        }
+        cmd->fields |= field;
+        if (field == XYE_FIELD_MODE) cmd->mode = value;
+        if (field == XYE_FIELD_FAN)  cmd->fan = value;
+        if (field == XYE_FIELD_TEMP) cmd->temp = value;
+        if (field == XYE_FIELD_FLAGS) cmd->flags = value;
+        return true;
+    }
+    
+    // Queue a command without payload (lock/unlock)
+    bool push(uint8_t type) {
+        if (count > 0 && back().type == type) {
+            merged++;
+            return true;
+        }
+        return append(type) != nullptr;
+    }
+    
+private:
+    XYECommand items[XYE_CMD_QUEUE_LEN];
+    uint8_t head = 0;
+    uint8_t count = 0;
+    
+    XYECommand& back() { return items[(head + count - 1) % XYE_CMD_QUEUE_LEN]; }
+    
+    XYECommand* append(uint8_t type) {
+        if (count == XYE_CMD_QUEUE_LEN) {
+            overflows++;
+            return nullptr;
+        }
+        count++;
+        back() = XYECommand();
+        back().type = type;
+        return &back();
+    }
+};
+
 // ============================================================================
 // XYE Protocol State
 // ============================================================================
 
+template <typename V = XYE_DEFAULT_VARIANT>
 class XYEState {
 public:
+    using Variant = V;
+    using Codec = XYECodec<V>;
+    
+    // Mode byte position in set commands for this variant
+    static constexpr uint8_t sendModeIndex() { return V::modeIndex; }
+    
     // Current state
     uint8_t setTemp = 72;           // Temperature setpoint (°F)
     uint8_t fanBytes = FAN_AUTO;    // Current fan mode
     uint8_t opBytes = MODE_OFF;     // Current operating mode
+    uint8_t modeFlags = MODE_FLAG_NORM; // Current mode flags (sent by Variant B only)
     
     // Communication state
-    bool newInput = false;          // New command pending
-    bool doneReading = false;       // Finished reading response
-    bool waitingToSend = false;     // Command queued for sending
+    uint8_t address = 0x00;         // Unit address on the bus (Server ID)
     bool waitingForResponse = false; // Waiting for response
     bool commandSent = false;       // Command was just sent
+    uint8_t missedResponses = 0;    // Consecutive response timeouts
+    bool checkSource = false;       // Drop responses of other units (set by setAddress)
+    uint32_t foreignFrames = 0;     // Responses of other units dropped while waiting
     
     // Timing/counters
-    uint8_t waitCount = 0;          // Response wait cycles
-    uint8_t prevResp = 0;           // Previous buffer size (for stale data detection)
-    uint8_t sendTimeCount = 0;      // Input debounce counter
-    
-    // Data buffers
-    uint8_t recData[30] = {0};      // Received data buffer
-    
-    // Command packet template
-    // Mode is at byte 11 (0x0B), not byte 6!
-    uint8_t sendData[16] = {
-        0xAA,   // [0x00] Start byte
-        0xC3,   // [0x01] Command type
-        0x00,   // [0x02]
-        0x00,   // [0x03]
-        0x80,   // [0x04]
-        0x00,   // [0x05]
-        0x00,   // [0x06]
-        0x00,   // [0x07] Fan (filled in before send)
-        0x00,   // [0x08] Temp (filled in before send)
-        0x00,   // [0x09] Timer 1
-        0x00,   // [0x0A] Timer 2
-        0x00,   // [0x0B] Mode (filled in before send)
-        0x00,   // [0x0C]
-        0x3C,   // [0x0D]
-        0x00,   // [0x0E] CRC (calculated before send)
-        0x55    // [0x0F] End byte
-    };
+    uint32_t sentAt = 0;            // millis() of the last transmit
     
-    // Queued command buffer
-    uint8_t waitSendData[16] = {
-        0xAA, 0xC3, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x3C, 0x00, 0x55
-    };
+    // Response buffers
+    // Double-buffered: the parser fills the back buffer in place and a
+    // validated frame is published by flipping `front`. Readers always see a
+    // complete frame and nothing is copied.
+    uint8_t frames[2][REC_LEN] = {{0}};
+    uint8_t front = 0;              // Index of the last validated response
+    uint32_t frameSeq = 0;          // Number of validated responses (0 = none yet)
+    uint32_t changedMask = 0;       // Bit i set when byte i changed in the last frame
+    XYEChangeLog changeLog;         // Byte changes of recent frames
+    XYEStatus status;               // Decoded fault status of the last frame
+    XYEStatus statusChanges;        // Status bits that changed in the last frame
+    XYEFrameParser parser;          // Response frame parser
+    XYEQueryScheduler scheduler;    // Status query timing
     
-    // Query packet (constant - used to poll status)
-    const uint8_t queryData[16] = {
-        0xAA,   // [0] Start byte
-        0xC0,   // [1] Query type
-        0x00,   // [2]
-        0x00,   // [3]
-        0x80,   // [4]
-        0x00,   // [5]
-        0x00,   // [6]
-        0x00,   // [7]
-        0x00,   // [8]
-        0x00,   // [9]
-        0x00,   // [10]
-        0x00,   // [11]
-        0x00,   // [12]
-        0x3F,   // [13]
-        0x81,   // [14] CRC
-        0x55    // [15] End byte
-    };
+    // Status query for this unit's address
+    XYEPacket queryPacket = XYE_QUERY_PACKET;
+    
+    // Last command packet sent by takeCommand()
+    XYEPacket sendData = Codec::setTemplate();
+    
+    // Commands waiting for the bus
+    XYECommandQueue commands;
+    
+    // Write a packet to the bus and start waiting for its response
+    void transmit(const uint8_t* data, uint8_t len) {
+        xyeSerial.write(data, len);
+        sentAt = millis();
+        waitingForResponse = true;
+    }
     
-    // Response validation header
-    const uint8_t checkData[6] = {0xAA, 0xC0, 0x80, 0x00, 0x00, 0x00};
+    // True when nothing is being received, so a packet can be sent
+    bool busIdle() {
+        return xyeSerial.available() == 0 && !parser.busy();
+    }
+    
+    // Drain the UART into the frame parser. Called every 10ms from an
+    // interval, so a response is handled within about 10ms of its last byte
+    // (later while the main loop is busy elsewhere). Stops after
+    // one frame so every response gets processed; remaining bytes are left
+    // in the UART buffer for the next call.
+    XYERxStatus receive(uint32_t now) {
+        while (xyeSerial.available() > 0) {
+            if (parser.feed(xyeSerial.read(), now)) {
+                // On a shared line a unit that answered after its timeout
+                // would otherwise be taken as the unit polled next; keep
+                // waiting for the right one
+                if (checkSource && frames[front ^ 1][REC_SERVER_ID] != address) {
+                    foreignFrames++;
+                    continue;
+                }
+                commitFrame();
+                waitingForResponse = false;
+                return XYE_RX_FRAME;
+            }
+        }
+        parser.expire(now);
+        
+        if (waitingForResponse && (now - sentAt) > XYE_RESPONSE_TIMEOUT_MS) {
+            waitingForResponse = false;
+            return XYE_RX_TIMEOUT;
+        }
+        return XYE_RX_PENDING;
+    }
+    
+    // Publish the back buffer as the new response and hand the old one to
+    // the parser
+    void commitFrame() {
+        uint8_t back = front ^ 1;
+        uint32_t mask = 0;
+        for (uint8_t i = 0; i < REC_CRC; i++) {
+            if (frameSeq == 0 || frames[back][i] != frames[front][i]) {
+                mask |= 1UL << i;
+            }
+        }
+        changedMask = mask;
+        front = back;
+        frameSeq++;
+        if (frameSeq > 1) {
+            changeLog.record(frameSeq, mask);
+        }
+        
+        // Only decode the fault bytes when one of them changed
+        if (frameSeq == 1) {
+            status = XYEStatus::decode(frames[front]);
+            statusChanges.errors = 0xFFFF;
+            statusChanges.protection = 0xFFFF;
+            statusChanges.ccm = 0xFF;
+        } else if (mask & XYE_STATUS_BYTES) {
+            XYEStatus decoded = XYEStatus::decode(frames[front]);
+            statusChanges = XYEStatus::diff(status, decoded);
+            status = decoded;
+        } else {
+            statusChanges = XYEStatus();
+        }
+        parser.attach(frames[front ^ 1]);
+    }
+    
+    // Publish a response validated elsewhere (XYEBusTask)
+    void acceptFrame(const uint8_t* frame) {
+        memcpy(frames[front ^ 1], frame, REC_LEN);
+        commitFrame();
+    }
+    
+    XYEState() {
+        parser.attach(frames[front ^ 1]);
+    }
+    
+    void setAddress(uint8_t unitAddress) {
+        address = unitAddress;
+        checkSource = true;
+        queryPacket.patch(SEND_SERVER_ID, unitAddress);
+    }
+    
+    // True once the unit answered and it did not miss the last few queries
+    bool online() const {
+        return frameSeq > 0 && missedResponses < XYE_OFFLINE_AFTER;
+    }
+    
+    // Bookkeeping after receive() reported a frame or a timeout. Returns true
+    // when the state reported by the unit was taken over; right after a
+    // command, or while commands are pending, the wanted state is kept.
+    bool handleResult(XYERxStatus rx, uint32_t now) {
+        if (rx == XYE_RX_TIMEOUT) {
+            commandSent = false;
+            if (missedResponses < 0xFF) {
+                missedResponses++;
+            }
+            scheduler.onTimeout();
+            return false;
+        }
+        if (rx != XYE_RX_FRAME) {
+            return false;
+        }
+        
+        missedResponses = 0;
+        scheduler.onResponse(now, frameSeq > 1 && changedAny(XYE_STATE_BYTES));
+        bool apply = !commandSent && commands.empty();
+        commandSent = false;
+        if (apply) {
+            applyResponse();
+        }
+        return apply;
+    }
+    
+    // Change the wanted mode/fan/setpoint and queue it for the unit
+    void requestMode(uint8_t mode) {
+        opBytes = mode;
+        commands.set(XYE_FIELD_MODE, mode);
+    }
+    void requestFan(uint8_t fan) {
+        fanBytes = fan;
+        commands.set(XYE_FIELD_FAN, fan);
+    }
+    void requestTemp(uint8_t temp) {
+        setTemp = temp;
+        commands.set(XYE_FIELD_TEMP, temp);
+    }
+    void requestFlags(uint8_t flags) {
+        modeFlags = flags;
+        commands.set(XYE_FIELD_FLAGS, flags);
+    }
+    
+    // Take over the state reported by the unit
+    void applyResponse() {
+        const uint8_t* response = frames[front];
+        opBytes = Codec::decodeMode(response);
+        fanBytes = Codec::decodeFan(response);
+        setTemp = Codec::decodeTemp(response);
+        modeFlags = Codec::decodeFlags(response);
+    }
+    
+    // True when the next queued command can go out right now
+    bool canSendCommand() {
+        return !commands.empty() && !waitingForResponse && busIdle();
+    }
+    
+    // Fill sendData from the oldest queued command and remove it from the
+    // queue. Fields not carried by the command keep their wanted value.
+    const uint8_t* takeCommand() {
+        const XYECommand& cmd = commands.front();
+        if (cmd.type != XYE_CMD_SET) {
+            sendData = (cmd.type == XYE_CMD_LOCK) ? XYE_LOCK_PACKET : XYE_UNLOCK_PACKET;
+        } else {
+            sendData = Codec::setTemplate();
+            Codec::encodeSet(sendData,
+                             (cmd.fields & XYE_FIELD_MODE) ? cmd.mode : opBytes,
+                             (cmd.fields & XYE_FIELD_FAN) ? cmd.fan : fanBytes,
+                             (cmd.fields & XYE_FIELD_TEMP) ? cmd.temp : setTemp,
+                             (cmd.fields & XYE_FIELD_FLAGS) ? cmd.flags : modeFlags);
+        }
+        sendData.patch(SEND_SERVER_ID, address);
+        commands.pop();
+        return sendData.bytes;
+    }
+    
+    // Last validated response and single bytes of it
+    const uint8_t* response() const { return frames[front]; }
+    uint8_t rx(uint8_t index) const { return frames[front][index]; }
+    
+    // Byte of the previous response; valid until the parser starts on the
+    // next frame, i.e. in the loop iteration that received the current one
+    uint8_t prev(uint8_t index) const { return frames[front ^ 1][index]; }
+    
+    // True when byte `index` changed in the last validated response
+    // (every byte counts as changed for the first one)
+    bool changed(uint8_t index) const { return (changedMask >> index) & 1; }
+    bool changedAny(uint32_t mask) const { return (changedMask & mask) != 0; }
     
     // Helper methods
-    const char* getModeString() {
-        switch (opBytes) {
-            case MODE_OFF:      return "Off";
-            case MODE_AUTO:     return "Auto";
-            case MODE_AUTO_ALT: return "Auto";  // Some units use 0x80
-            case MODE_COOL:     return "Cool";
-            case MODE_DRY:      return "Dry";
-            case MODE_HEAT:     return "Heat";
-            case MODE_FAN_ONLY: return "Fan Only";
-            default:            return "Unknown";
+    const char* getModeString() const { return xyeModeName(opBytes); }
+    const char* getFanString() const { return xyeFanName(fanBytes); }
+    
+};
+
+// ============================================================================
+// Bus Master (several units on one XYE line)
+// ============================================================================
+//
+// Polls N units sharing one RS-485 line. Only one request is outstanding at
+// a time: the line is half duplex and a unit only answers a request for its
+// own address, so a second request sent before the response would collide
+// with it. Instead of pipelining, the next request is dispatched in the same
+// loop iteration in which the previous response completed, so the bus is
+// never idle while a unit is due. Responses carry the Server ID of the unit
+// that answered; one that arrives after its timeout is dropped (and counted
+// in foreignFrames of the unit polled next) instead of taken as its state. Each unit keeps its own scheduler and
+// command queue. Queued commands go first, then due queries, round-robin
+// starting after the last unit served, so every unit gets a turn.
+//
+// One transaction takes ~120 ms (16 byte query + 32 byte response at
+// 4800 baud plus turnaround), so 8 units can all be refreshed in about a
+// second when they are all due.
+
+template <uint8_t N, typename V = XYE_DEFAULT_VARIANT>
+class XYEBusMaster {
+public:
+    XYEState<V> units[N];
+    uint8_t active = 0;  // Unit with the outstanding (or last) request
+    XYERxStatus lastRx = XYE_RX_PENDING;  // How the last finished request ended
+    
+    // Drive the bus, called every 10ms (every tick in the bus task). Returns
+    // the index of the unit whose request finished in this call, or -1.
+    int8_t poll(uint32_t now) {
+        int8_t finished = -1;
+        XYEState<V>& unit = units[active];
+        XYERxStatus rx = unit.receive(now);
+        if (rx != XYE_RX_PENDING) {
+            unit.handleResult(rx, now);
+            lastRx = rx;
+            finished = active;
+        }
+        if (!unit.waitingForResponse && unit.busIdle()) {
+            dispatch(now);
         }
+        return finished;
     }
     
-    const char* getFanString() {
-        switch (fanBytes) {
-            case FAN_AUTO:       return "Auto";
-            case FAN_HIGH:       return "High";
-            case FAN_MEDIUM:     return "Medium";
-            case FAN_MEDIUM_LOW: return "Medium-Low";
-            case FAN_LOW:        return "Low";
-            default:             return "Unknown";
+private:
+    void dispatch(uint32_t now) {
+        // Commands first
+        for (uint8_t k = 1; k <= N; k++) {
+            uint8_t i = (active + k) % N;
+            if (!units[i].commands.empty()) {
+                active = i;
+                units[i].transmit(units[i].takeCommand(), SEND_LEN);
+                units[i].commandSent = true;
+                units[i].scheduler.boost(now);
+                return;
+            }
+        }
+        // Then the next unit that is due for a query
+        for (uint8_t k = 1; k <= N; k++) {
+            uint8_t i = (active + k) % N;
+            if (units[i].scheduler.due(now)) {
+                active = i;
+                units[i].transmit(units[i].queryPacket.bytes, SEND_LEN);
+                units[i].scheduler.onQuerySent(now);
+                return;
+            }
         }
     }
+};
+
+// ============================================================================
+// Bus Task (ESP32, optional)
+// ============================================================================
+//
+// With XYE_BUS_TASK set, the bus master runs in its own FreeRTOS task pinned
+// to the core the ESPHome loop does not use, so the request/response timing
+// no longer depends on how long Wi-Fi, the API or the web server hold up the
+// main loop. The task owns a private XYEBusMaster that does all UART I/O.
+// It hands every finished request to the main loop through a lock-free
+// single-producer/single-consumer queue; commands queued on xyeBus travel
+// the other way through a second one. xyeBus keeps the state all lambdas
+// read, and is only ever touched by the main loop.
+
+// Run the bus master in a task of its own, set with the xye_bus_task
+// substitution. ESP32 only.
+#ifndef XYE_BUS_TASK
+#define XYE_BUS_TASK 0
+#endif
+
+#ifndef XYE_BUS_TASK_CORE
+#define XYE_BUS_TASK_CORE 0  // The Arduino loop task runs on core 1
+#endif
+
+#ifndef XYE_BUS_TASK_PRIORITY
+#define XYE_BUS_TASK_PRIORITY 5
+#endif
+
+#ifndef XYE_BUS_TASK_STACK
+#define XYE_BUS_TASK_STACK 4096
+#endif
+
+// Entries of the result and command queues (one slot stays free)
+#ifndef XYE_BUS_TASK_QUEUE_LEN
+#define XYE_BUS_TASK_QUEUE_LEN 8
+#endif
+
+// Fixed-size queue between exactly one producer and one consumer. The
+// producer only writes `tail`, the consumer only writes `head`; the
+// release/acquire pair makes the item visible before the index that
+// publishes it.
+template <typename T, uint8_t LEN>
+class XYESpscQueue {
+public:
+    uint32_t overflows = 0;  // Items dropped because the queue was full (producer side)
     
-} xyeState;
+    bool push(const T& item) {
+        uint8_t tail = tail_.load(std::memory_order_relaxed);
+        uint8_t next = (tail + 1) % LEN;
+        if (next == head_.load(std::memory_order_acquire)) {
+            overflows++;
+            return false;
+        }
+        items[tail] = item;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+    
+    bool pop(T& item) {
+        uint8_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[head];
+        head_.store((head + 1) % LEN, std::memory_order_release);
+        return true;
+    }
+    
+private:
+    T items[LEN];
+    std::atomic<uint8_t> head_{0};
+    std::atomic<uint8_t> tail_{0};
+};
+
+#if XYE_BUS_TASK && defined(XYE_BUS_UNITS)
+
+#if !defined(ESP32)
+#error "XYE_BUS_TASK needs an ESP32"
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+template <uint8_t N, typename V = XYE_DEFAULT_VARIANT>
+class XYEBusTask {
+public:
+    explicit XYEBusTask(XYEBusMaster<N, V>& bus) : bus(bus) {}
+    
+    // Start the task, called at boot once the units of `bus` have their
+    // address and scheduler settings
+    void start() {
+        for (uint8_t i = 0; i < N; i++) {
+            engine.units[i].setAddress(bus.units[i].address);
+            engine.units[i].scheduler = bus.units[i].scheduler;
+        }
+        xTaskCreatePinnedToCore(run, "xye_bus", XYE_BUS_TASK_STACK, this, XYE_BUS_TASK_PRIORITY, &handle,
+                                XYE_BUS_TASK_CORE);
+    }
+    
+    // Take over the finished requests and hand queued commands to the task,
+    // called from the main loop in place of XYEBusMaster::poll(). Returns the
+    // index of the last unit whose request finished, or -1.
+    int8_t service(uint32_t now) {
+        int8_t finished = -1;
+        Result result;
+        while (results.pop(result)) {
+            XYEState<V>& unit = bus.units[result.unit];
+            if (result.rx == XYE_RX_FRAME) {
+                unit.acceptFrame(result.frame);
+            }
+            unit.foreignFrames = result.foreignFrames;
+            unit.commandSent = result.command;
+            unit.handleResult(result.rx, now);
+            finished = result.unit;
+        }
+        for (uint8_t i = 0; i < N; i++) {
+            XYECommandQueue& queued = bus.units[i].commands;
+            // Left queued here when the task has no room yet
+            while (!queued.empty() && commands.push(Command{i, queued.front()})) {
+                queued.pop();
+            }
+        }
+        return finished;
+    }
+    
+    // Results the main loop did not take over in time
+    uint32_t lostResults() const { return results.overflows; }
+    
+private:
+    struct Result {
+        uint8_t unit;
+        XYERxStatus rx;
+        bool command;  // Response to a command
+        uint32_t foreignFrames;
+        uint8_t frame[REC_LEN];
+    };
+    
+    struct Command {
+        uint8_t unit;
+        XYECommand command;
+    };
+    
+    XYEBusMaster<N, V>& bus;    // Main loop side
+    XYEBusMaster<N, V> engine;  // Bus task side
+    XYESpscQueue<Result, XYE_BUS_TASK_QUEUE_LEN> results;
+    XYESpscQueue<Command, XYE_BUS_TASK_QUEUE_LEN> commands;
+    TaskHandle_t handle = nullptr;
+    
+    static void run(void* self) {
+        static_cast<XYEBusTask*>(self)->loop();
+    }
+    
+    void loop() {
+        for (;;) {
+            Command queued;
+            while (commands.pop(queued)) {
+                enqueue(engine.units[queued.unit].commands, queued.command);
+            }
+            
+            uint32_t now = millis();
+            // poll() clears the flag when the outstanding request finishes
+            bool command = engine.units[engine.active].commandSent;
+            int8_t done = engine.poll(now);
+            if (done >= 0) {
+                Result result;
+                result.unit = done;
+                result.rx = engine.lastRx;
+                result.command = command;
+                result.foreignFrames = engine.units[done].foreignFrames;
+                memcpy(result.frame, engine.units[done].response(), REC_LEN);
+                results.push(result);
+            }
+            vTaskDelay(1);
+        }
+    }
+    
+    static void enqueue(XYECommandQueue& queue, const XYECommand& cmd) {
+        if (cmd.type != XYE_CMD_SET) {
+            queue.push(cmd.type);
+            return;
+        }
+        if (cmd.fields & XYE_FIELD_MODE)  queue.set(XYE_FIELD_MODE, cmd.mode);
+        if (cmd.fields & XYE_FIELD_FAN)   queue.set(XYE_FIELD_FAN, cmd.fan);
+        if (cmd.fields & XYE_FIELD_TEMP)  queue.set(XYE_FIELD_TEMP, cmd.temp);
+        if (cmd.fields & XYE_FIELD_FLAGS) queue.set(XYE_FIELD_FLAGS, cmd.flags);
+    }
+};
+
+#endif
+
+#ifdef XYE_BUS_UNITS
+XYEBusMaster<XYE_BUS_UNITS> xyeBus;  // Multi-unit configuration
+#if XYE_BUS_TASK
+XYEBusTask<XYE_BUS_UNITS> xyeBusTask(xyeBus);
+#endif
+#else
+XYEState<> xyeState;                 // Single unit configuration
+#endif
@@ -1,9 +1,4 @@
 #include "esphome.h"
-#include <iostream>
-#include <sstream>
-#include <iomanip>
-#include <string>
-#include <vector>
 
 
 #define RX_PIN 16
@@ -39,8 +34,8 @@ class xyeVars {
     uint8_t setTemp = 70;
     uint8_t sendTimeCount = 0;
     bool newInput = false;
-    std::string op = "off";
-    std::string fan = "auto";
+    const char* op = "off";   // Always one of the select option literals
+    const char* fan = "auto";
     uint8_t fanBytes = 0x00;
     uint8_t opBytes = 0x00;
     bool doneReading = false;